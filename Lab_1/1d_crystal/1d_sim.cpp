@@ -1,176 +1,60 @@
 #include <iostream>
 #include <random>
 #include <stdio.h>
+#include <string>
 
-std::random_device rdev;
-std::mt19937 r_gen(rdev());
-std::uniform_int_distribution<std::mt19937::result_type> d2(0, 1);
-std::uniform_int_distribution<std::mt19937::result_type> d3(0, 2);
+#include "../crystal/crystal.h"
+#include "../crystal/render.h"
 
-enum State {Dislocation, Atom};
-enum Direction {Left, Right};
-class Cell{
-    private:
-        bool active;
-        State state;
-        State future;
-    public:
-        Cell(){
-            this->active = false;
-            this->future = Atom;
-            this->state = Atom;
-        };
-        void create(State state){
-            this->active = true;
-            this->future = Atom;
-            this->state = state;
-        }
-        void deactivate(){
-            this->active=false;
-            this->future = this->state;
-        }
-        void set_future(State future){
-            this->future = future;
-        }
-        void update_state(){
-            this->state = this->future;
-        }
-        bool is_active(){
-            return this->active;
-        }
-        State get_state(){
-            return this->state;
-        }
-        State get_future(){
-            return this->future;
-        }
-        std::string to_str(){
-            if (this->state == Dislocation){
-                return "■";
-            }
-            return " ";
-        }
-};
-class Crystal{
-    private:
-        Cell* matrix;
-        unsigned int size;
-        bool running;
-    public:
-        Crystal(bool* scheme, unsigned int size){
-            this->size = size;
-            this->running = true;
+std::uniform_int_distribution<unsigned int> d3(0, 2);
 
-            this->matrix = new Cell[size];
-            for(int i = 0; i < size; i++){
-                State cell_state = (scheme[i]) ? Dislocation : Atom;
-                this->matrix[i].create(cell_state);
-            }
+// Usage: 1d_sim [seed] [--size N] [--free [FPS]]
+// Steps on Enter; --free runs at full speed and redraws FPS times a second
+// (default 30). Chains wider than the terminal are shown downsampled.
+int main(int argc, char** argv){
 
-            this->matrix[0].deactivate();
-            this->matrix[this->size - 1].deactivate();
-        }
-        ~Crystal(){
-            delete[] this->matrix;
-        }
-        void display(){
-            for (int j = 0; j < 2 * this->size + 1; j++){
-                std::cout << "--";
-            }
-            std::cout << "\n";
-            for (int i = 0; i < this->size; i++){
-                std::cout << " | " << this->matrix[i].to_str();
-            }
-            std::cout << " |\n";
-            for (int j = 0; j < 2 * this->size + 1; j++){            
-                std::cout << "--";
-            }                                                     
-            std::cout << "\n";
-        }
-        bool is_running(){
-            return this->running;
-        }
-        void check_activity(){
-            this->running = false;
-            for (int i = 0; i < this->size; i++){
-
-                if(this->matrix[i].is_active() && 
-                   this->matrix[i].get_state() == Dislocation){
-                    this->running = true;
-                    i = this->size;
-                }
-            }
-        }
-        void update_activity(){
-            for (int i = 1; i < this->size - 1; i++){
-                if (this->matrix[i].get_state() == Dislocation){
-                    Cell* left =  &this->matrix[i - 1];
-                    Cell* right =  &this->matrix[i + 1];
-
-                    if (left->get_state() == Dislocation
-                        || right->get_state() == Dislocation){
-                        this->matrix[i].deactivate();
-                    }
-                }
-            }
+    std::uint64_t seed = random_seed();
+    int size = 15;
+    bool free_running = false;
+    double fps = 30;
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc){
+            size = std::stoi(argv[++i]);
         }
-        void calculate_state(){
-            for (int i = 1; i < this->size - 1; i++){
-                if (this->matrix[i].is_active() 
-                    && this->matrix[i].get_state() == Dislocation){
-
-                    Direction dir = Direction(d2(r_gen));
-                    Cell* target;
-                    switch (dir){
-                        case Left:
-                            target = &this->matrix[i - 1];
-                            break;
-                        case Right:
-                            target = &this->matrix[i + 1];
-                            break;
-                    }
-                    if (target->get_future() == Atom){
-                        target->set_future(Dislocation);
-                    }
-                    else{
-                        this->matrix[i].set_future(Dislocation);
-                    }
-                }
+        else if (arg == "--free"){
+            free_running = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-'){
+                fps = std::stod(argv[++i]);
             }
         }
-        void update_state(){
-            for (int i = 0; i < this->size; i++){
-                this->matrix[i].update_state();
-                if (this->matrix[i].is_active()){
-                    this->matrix[i].set_future(Atom);
-                }
-            }
+        else{
+            seed = std::stoull(arg);
         }
-};
-
-int main(){
-     
+    }
+    CounterGenerator<> r_gen(RunKey{seed, 0});
 
-    int size = 15;
     bool* scheme = new bool [size];
     for (int i = 0; i < size; i++){
         scheme[i] = (d3(r_gen) == 0);
     }
-    Crystal crystal(scheme, size);
+    Crystal<1> crystal(scheme, size, RunKey{seed, 0});
+    delete[] scheme;
+    Renderer renderer(1, size);
+    if (free_running){
+        free_run(crystal, renderer, fps);
+        return 0;
+    }
+    unsigned long long steps = 0;
     while (crystal.is_running()){
 
-        system("clear");
-        crystal.display();
-        crystal.update_activity();
-        crystal.check_activity();
-        crystal.calculate_state();
-        crystal.update_state();
-        std::cout << "Press any button to step";
+        renderer.draw(crystal, "step " + std::to_string(steps) + ", press Enter to step");
+        crystal.step();
+        steps++;
         getchar();
     }
-    std::cout << "Press any button to exit";
+    renderer.draw(crystal, "step " + std::to_string(steps) + ", relaxed; press Enter to exit");
     getchar();
 
     return 0;
 }
-
@@ -1,248 +1,56 @@
 #include <iostream>
-#include <algorithm>
 #include <fstream>
-#include <cmath>
-#include <random>
-#include <stdio.h>
+#include <string>
 
-std::random_device rdev;
-std::mt19937 r_gen(rdev());
-std::uniform_int_distribution<std::mt19937::result_type> d4(0, 3);
-std::uniform_int_distribution<std::mt19937::result_type> d10(0, 9);
+#include "../crystal/adaptive.h"
+#include "../crystal/checkpoint.h"
+#include "../crystal/exact.h"
+#include "../crystal/experiment.h"
+#include "../crystal/kinetic.h"
+#include "../crystal/replica.h"
+#include "../crystal/symmetry.h"
 
-enum State {Dislocation, Atom};
-enum Direction {Left, Down, Up, Right};
-class Cell{
-    private:
-        bool active;
-        State state;
-        State future;
-    public:
-        Cell(){
-            this->active = false;
-            this->future = Atom;
-            this->state = Atom;
-        };
-        void create(State state){
-            this->active = true;
-            this->future = Atom;
-            this->state = state;
-        }
-        void deactivate(){
-            this->active=false;
-            this->future = this->state;
-        }
-        void set_future(State future){
-            this->future = future;
-        }
-        void update_state(){
-            this->state = this->future;
-        }
-        bool is_active(){
-            return this->active;
-        }
-        State get_state(){
-            return this->state;
-        }
-        State get_future(){
-            return this->future;
-        }
-        std::string to_str(){
-            if (this->state == Dislocation){
-                return "8";
-            }
-            return " ";
-        }
-};
-
-class Crystal{
-    private:
-        Cell** matrix;
-        unsigned int height;
-        unsigned int width;
-        bool running;
-    public:
-        Crystal(int** scheme, unsigned int height, unsigned int width){
-            this->height = height;
-            this->width = width;
-            this->running = true;
-
-            this->matrix = new Cell*[height];
-            for(int i = 0; i < height; i++){
-                this->matrix[i] = new Cell[width];
-                for(int j = 0; j < width; j++){
-                    State cell_state = (scheme[i][j] == 1) ? Dislocation : Atom;
-                    this->matrix[i][j].create(cell_state);
-                }
-            }
-
-            for (int i = 0; i < this->height; i++){
-                this->matrix[i][0].deactivate();
-                this->matrix[i][this->width - 1].deactivate();
-            }
-            for (int j = 0; j < this->width; j++){
-                this->matrix[0][j].deactivate();
-                this->matrix[this->height - 1][j].deactivate();
-            }
-        }
-        ~Crystal(){
-            for(int i = 0; i < height; i++){
-                delete[] this->matrix[i];
-            }
-            delete[] this->matrix;
-        }
-        void display(){
-            for (int j = 0; j < 2 * this->width + 1; j++){
-                std::cout << "--";
-            }
-            std::cout << "\n";
-            for (int i = 0; i < this->height; i++){
-                for (int j = 0; j < this->width; j++){
-                    std::cout << " | " << this->matrix[i][j].to_str();
-                }
-                std::cout << " |\n";
-                for (int j = 0; j < 2 * this->width + 1; j++){
-                    std::cout << "--";
-                }
-                std::cout << "\n";
-            }
-        }
-        bool is_running(){
-            return this->running;
-        }
-        void check_activity(){
-            this->running = false;
-            for (int i = 0; i < this->height; i++){
-                for (int j = 0; j < this->width; j++){
-
-                    if(this->matrix[i][j].is_active() && 
-                       this->matrix[i][j].get_state() == Dislocation){
-
-                        this->running = true;
-                        i = this->height;
-                        j = this->width;
-                    }
-                }
-            }
+// Usage: ratio_test [--symmetric | --exact | --kinetic | --adaptive ERROR [--budget SECONDS]
+//                    | --lattice moore|hex]
+// --adaptive samples every point to the given relative standard error (or
+// for at most --budget seconds) and writes "ratio mean error samples".
+// --kinetic relaxes in continuous time and writes the mean absorption time.
+// --lattice runs the plain sweep on the eight-neighbour Moore lattice or on
+// the hexagonal one instead of the square lattice.
+// Progress is saved to ratio_data.checkpoint; rerunning with the same flags
+// after an interruption resumes the sweep where it stopped.
+int main(int argc, char** argv){
+     
+    bool symmetric = false;
+    bool exact = false;
+    bool kinetic = false;
+    double adaptive = 0;
+    double budget = 3600;
+    std::string lattice = "square";
+    for (int i = 1; i < argc; i++){
+        if (std::string(argv[i]) == "--symmetric"){
+            symmetric = true;
         }
-        void update_activity(){
-            for (int i = 1; i < this->height - 1; i++){
-                for (int j = 1; j < this->width - 1; j++){
-                    if (this->matrix[i][j].get_state() == Dislocation){
-                        Cell* top =  &this->matrix[i - 1][j];
-                        Cell* bottom =  &this->matrix[i + 1][j];
-                        Cell* left =  &this->matrix[i][j - 1];
-                        Cell* right =  &this->matrix[i][j + 1];
-
-                        if (top->get_state() == Dislocation 
-                            || bottom->get_state() == Dislocation
-                            || left->get_state() == Dislocation
-                            || right->get_state() == Dislocation){
-                           
-                            this->matrix[i][j].deactivate();
-                        }
-                    }
-                }
-            }
+        if (std::string(argv[i]) == "--exact"){
+            exact = true;
         }
-        void calculate_state(){
-            for (int i = 1; i < this->height - 1; i++){
-                for (int j = 1; j < this->width - 1; j++){
-                    if (this->matrix[i][j].is_active() 
-                        && this->matrix[i][j].get_state() == Dislocation){
-
-                        Direction dir = Direction(d4(r_gen));
-                        Cell* target;
-                        switch (dir){
-                            case Left:
-                                target = &this->matrix[i][j - 1];
-                                break;
-                            case Down:
-                                target = &this->matrix[i + 1][j];
-                                break;
-                            case Up:
-                                target = &this->matrix[i - 1][j];
-                                break;
-                            case Right:
-                                target = &this->matrix[i][j + 1];
-                                break;
-                        }
-                        if (target->get_future() == Atom){
-                            target->set_future(Dislocation);
-                        }
-                        else{
-                            this->matrix[i][j].set_future(Dislocation);
-                        }
-                    }
-                }
-            }
+        if (std::string(argv[i]) == "--kinetic"){
+            kinetic = true;
         }
-        void update_state(){
-            for (int i = 0; i < this->height; i++){
-                for (int j = 0; j < this->width; j++){
-                    this->matrix[i][j].update_state();
-                    if (this->matrix[i][j].is_active()){
-                        this->matrix[i][j].set_future(Atom);
-                    }
-                }
-            }
+        if (std::string(argv[i]) == "--adaptive" && i + 1 < argc){
+            adaptive = std::stod(argv[++i]);
         }
-};
-
-int cycle(int** scheme, int size){
-    int iter = 0;
-    Crystal crystal(scheme, size, size);
-    while (crystal.is_running()){
-
-        crystal.update_activity();
-        crystal.check_activity();
-        crystal.calculate_state();
-        crystal.update_state();
-        iter++;
-        if (iter > 1000000){
-            break;
+        if (std::string(argv[i]) == "--budget" && i + 1 < argc){
+            budget = std::stod(argv[++i]);
         }
-    }
-    return iter - 1;
-}
-long double test_run(unsigned int disloc_number, unsigned int size, int repeat_number){
-    long long unsigned int move_number = 0;
-    long long unsigned int cycle_number = 0;
-    unsigned int N = size * size;
-    unsigned int K = disloc_number;
-
-    int** scheme = new int*[size];
-    for(int i = 0; i < size; i++){
-        scheme[i] = new int[size];
-        for(int j = 0; j < size; j++){
-            scheme[i][j] = 0;
+        if (std::string(argv[i]) == "--lattice" && i + 1 < argc){
+            lattice = argv[++i];
         }
     }
 
-    for (int k = 0; k < repeat_number; k++){
-        std::string bitmask(K, 1);
-        bitmask.resize(N, 0);
-        do {
-            for(int i = 0; i < size; i++){
-                for(int j = 0; j < size; j++){
-                    scheme[i][j] = 0;
-                }
-            }
-            for (int i = 0; i < N; ++i)
-            {
-                if (bitmask[i]){
-                    scheme[i / size][i % size] = 1; 
-                } 
-            }
-            move_number += cycle(scheme, size);
-            cycle_number +=1;
-        } while (std::prev_permutation(bitmask.begin(), bitmask.end()));   
-    }
-    return (long double)(move_number) / cycle_number;
-}
-int main(){
-     
-    std::ofstream ratio_file("ratio_data", std::ios::out);
+    Checkpoint checkpoint("ratio_data.checkpoint", "ratio_data");
+    std::uint64_t seed = checkpoint.sweep_seed();
+    std::ofstream ratio_file("ratio_data", checkpoint.mode());
     int repeat_number = 1000;
     for (int size = 1; size <= 5; size++){
         std::cout << "size = " << size << "\n";
@@ -255,13 +63,40 @@ int main(){
         for (int disloc_number = 1; disloc_number <= size * size; disloc_number++){
             double ratio = disloc_number * 1.0 / (size * size);
             std::cout << disloc_number << "\n";
-            ratio_file << ratio << " " 
-                       << test_run(disloc_number, size, repeat_number) << "\n"; 
+            if (checkpoint.skip()){
+                continue;
+            }
+            ratio_file << ratio << " ";
+            if (adaptive > 0){
+                Estimate estimate = adaptive_run<2>(disloc_number, size, adaptive, budget, seed);
+                ratio_file << estimate.mean << " " << estimate.error << " "
+                           << estimate.samples << "\n";
+            }
+            else if (exact){
+                ratio_file << exact_run<2>(disloc_number, size) << "\n";
+            }
+            else if (kinetic){
+                ratio_file << kinetic_run<2>(disloc_number, size, repeat_number, seed) << "\n";
+            }
+            else if (symmetric){
+                ratio_file << symmetric_test_run<2>(disloc_number, size, repeat_number, seed) << "\n";
+            }
+            else if (lattice == "moore"){
+                ratio_file << checkpoint.test_run<2, MooreCrystal>(disloc_number, size, repeat_number) << "\n";
+            }
+            else if (lattice == "hex"){
+                ratio_file << checkpoint.test_run<2, HexCrystal>(disloc_number, size, repeat_number) << "\n";
+            }
+            else{
+                ratio_file << checkpoint.test_run<2, ReplicaCrystal>(disloc_number, size, repeat_number) << "\n";
+            }
+            checkpoint.finish(ratio_file);
         }
         std::cout << std::endl;
     }
 
     ratio_file.close();
+    checkpoint.close();
+    instrument_report(std::cerr);
     return 0;
 }
-
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "../crystal/adaptive.h"
+#include "../crystal/checkpoint.h"
+#include "../crystal/experiment.h"
+
+// Usage: ratio_test [--adaptive ERROR] [--budget SECONDS]
+// Past a side of 3 the placements of a cube are far too many to enumerate,
+// so every point is sampled to the given relative standard error (0.01 by
+// default, or for at most --budget seconds) and the output lines are
+// "ratio mean error samples".
+// Progress is saved to ratio_data.checkpoint; rerunning with the same flags
+// after an interruption resumes the sweep where it stopped.
+int main(int argc, char** argv){
+
+    double adaptive = 0.01;
+    double budget = 3600;
+    for (int i = 1; i < argc; i++){
+        if (std::string(argv[i]) == "--adaptive" && i + 1 < argc){
+            adaptive = std::stod(argv[++i]);
+        }
+        if (std::string(argv[i]) == "--budget" && i + 1 < argc){
+            budget = std::stod(argv[++i]);
+        }
+    }
+
+    Checkpoint checkpoint("ratio_data.checkpoint", "ratio_data");
+    std::uint64_t seed = checkpoint.sweep_seed();
+    std::ofstream ratio_file("ratio_data", checkpoint.mode());
+    for (int size = 3; size <= 6; size++){
+        std::cout << "size = " << size << "\n";
+        for (int disloc_number = 1; disloc_number <= size * size * size; disloc_number++){
+            double ratio = disloc_number * 1.0 / (size * size * size);
+            std::cout << disloc_number << "\n";
+            if (checkpoint.skip()){
+                continue;
+            }
+            ratio_file << ratio << " ";
+            Estimate estimate = adaptive_run<3>(disloc_number, size, adaptive, budget, seed);
+            ratio_file << estimate.mean << " " << estimate.error << " "
+                       << estimate.samples << "\n";
+            checkpoint.finish(ratio_file);
+        }
+        std::cout << std::endl;
+    }
+
+    ratio_file.close();
+    checkpoint.close();
+    instrument_report(std::cerr);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "../crystal/adaptive.h"
+#include "../crystal/checkpoint.h"
+#include "../crystal/exact.h"
+#include "../crystal/experiment.h"
+#include "../crystal/sparse.h"
+
+// Usage: singular_test [--exact | --adaptive ERROR [--budget SECONDS]]
+// --adaptive writes "size mean error samples" instead of "size mean".
+// --exact solves for the mean instead of sampling it, up to size 100.
+// Progress is saved to singular_data.checkpoint; rerunning with the same
+// flags after an interruption resumes the sweep where it stopped.
+int main(int argc, char** argv){
+
+    bool exact = false;
+    double adaptive = 0;
+    double budget = 3600;
+    for (int i = 1; i < argc; i++){
+        if (std::string(argv[i]) == "--exact"){
+            exact = true;
+        }
+        if (std::string(argv[i]) == "--adaptive" && i + 1 < argc){
+            adaptive = std::stod(argv[++i]);
+        }
+        if (std::string(argv[i]) == "--budget" && i + 1 < argc){
+            budget = std::stod(argv[++i]);
+        }
+    }
+
+    Checkpoint checkpoint("singular_data.checkpoint", "singular_data");
+    std::ofstream singular_file("singular_data", checkpoint.mode());
+    int max_size = exact ? 100 : 15;
+    for (int size = 1; size <= max_size; size++){
+        std::cout << size << "\n";
+        if (checkpoint.skip()){
+            continue;
+        }
+        singular_file << size << " ";
+        if (exact){
+            singular_file << first_passage_run<3>(size) << "\n";
+        }
+        else if (adaptive > 0){
+            Estimate estimate = adaptive_run<3, SparseCrystal>(1, size, adaptive, budget,
+                                                                   checkpoint.sweep_seed());
+            singular_file << estimate.mean << " " << estimate.error << " " << estimate.samples << "\n";
+        }
+        else{
+            singular_file << checkpoint.test_run<3, SparseCrystal>(1, size, 100) << "\n";
+        }
+        checkpoint.finish(singular_file);
+    }
+    singular_file.close();
+    checkpoint.close();
+    instrument_report(std::cerr);
+    return 0;
+}
@@ -0,0 +1,275 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../crystal/bitboard.h"
+#include "../crystal/crystal.h"
+#include "../crystal/experiment.h"
+#include "../crystal/replica.h"
+#include "../crystal/sparse.h"
+
+// Usage: benchmark [--quick] [--output FILE]
+//
+// Times the four step phases of every engine on random lattices of several
+// sizes and densities, and whole cycle() runs on the small lattices of the
+// sweeps, on one thread, and the strip-parallel step of the largest square
+// on growing thread pools. Writes one JSON document (to stdout by default)
+// with steps/sec and ns per site for every case, so runs on different
+// commits or machines can be compared directly.
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point start){
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Collects the JSON objects of one array.
+class JsonArray{
+    private:
+        std::vector<std::string> items;
+        std::ostringstream item;
+        bool first;
+    public:
+        JsonArray(){
+            this->first = true;
+        }
+        template <typename T>
+        JsonArray& field(const std::string& name, const T& value){
+            this->item << (this->first ? "{" : ", ") << "\"" << name << "\": " << value;
+            this->first = false;
+            return *this;
+        }
+        JsonArray& field(const std::string& name, const char* value){
+            this->item << (this->first ? "{" : ", ") << "\"" << name << "\": \"" << value << "\"";
+            this->first = false;
+            return *this;
+        }
+        void close(){
+            this->items.push_back(this->item.str() + "}");
+            this->item.str("");
+            this->first = true;
+        }
+        void write(std::ostream& out, const std::string& indent){
+            out << "[";
+            for (std::size_t i = 0; i < this->items.size(); i++){
+                out << (i ? ",\n" : "\n") << indent << "  " << this->items[i];
+            }
+            out << "\n" << indent << "]";
+        }
+};
+
+// Steps one engine on a random lattice with the given density of
+// dislocations and times each phase separately.
+template <unsigned int Dim, template <unsigned int> class Engine>
+void bench_phases(JsonArray& results, const char* engine, unsigned int side, double density,
+                  double work){
+    typename Engine<Dim>::Extent extent;
+    extent.fill(side);
+    std::size_t sites = 1;
+    for (unsigned int d = 0; d < Dim; d++){
+        sites *= side;
+    }
+    CounterGenerator<> r_gen(RunKey{1, sites});
+    std::bernoulli_distribution placed(density);
+    bool* scheme = new bool[sites];
+    for (std::size_t i = 0; i < sites; i++){
+        scheme[i] = placed(r_gen);
+    }
+
+    unsigned int steps = std::max(5.0, std::min(1000.0, work / sites));
+    Engine<Dim> crystal(scheme, extent, RunKey{1, 0});
+    delete[] scheme;
+    double phase[4] = {0, 0, 0, 0};
+    unsigned int running_steps = 0;
+    for (unsigned int s = 0; s < steps; s++){
+        Clock::time_point t0 = Clock::now();
+        crystal.update_activity();
+        Clock::time_point t1 = Clock::now();
+        crystal.check_activity();
+        Clock::time_point t2 = Clock::now();
+        crystal.calculate_state();
+        Clock::time_point t3 = Clock::now();
+        crystal.update_state();
+        Clock::time_point t4 = Clock::now();
+        phase[0] += std::chrono::duration<double>(t1 - t0).count();
+        phase[1] += std::chrono::duration<double>(t2 - t1).count();
+        phase[2] += std::chrono::duration<double>(t3 - t2).count();
+        phase[3] += std::chrono::duration<double>(t4 - t3).count();
+        running_steps += crystal.is_running();
+    }
+
+    const char* names[4] = {"update_activity", "check_activity", "calculate_state", "update_state"};
+    double total = phase[0] + phase[1] + phase[2] + phase[3];
+    double site_steps = double(sites) * steps;
+    results.field("engine", engine).field("dim", Dim).field("side", side).field("sites", sites)
+           .field("density", density).field("steps", steps).field("running_steps", running_steps)
+           .field("steps_per_sec", steps / total).field("ns_per_site", total * 1e9 / site_steps);
+    for (int p = 0; p < 4; p++){
+        results.field(std::string(names[p]) + "_ns_per_site", phase[p] * 1e9 / site_steps);
+    }
+    results.close();
+    std::cerr << engine << " " << Dim << "d side " << side << " density " << density
+              << ": " << total * 1e9 / site_steps << " ns/site\n";
+}
+
+// Relaxes runs of a sweep point with RunRange, doubling their number until
+// they take at least min_seconds, and reports runs and steps per second.
+template <unsigned int Dim, template <unsigned int> class Engine>
+void bench_cycle(JsonArray& results, const char* engine, unsigned int side, unsigned int disloc_number,
+                 double min_seconds){
+    std::size_t sites = 1;
+    for (unsigned int d = 0; d < Dim; d++){
+        sites *= side;
+    }
+    unsigned long long runs = 16;
+    long long unsigned int steps;
+    double elapsed;
+    while (true){
+        Clock::time_point start = Clock::now();
+        steps = RunRange<Dim, Engine>::sum(disloc_number, side, 1, 0, runs);
+        elapsed = seconds_since(start);
+        if (elapsed >= min_seconds){
+            break;
+        }
+        runs *= 2;
+    }
+    results.field("engine", engine).field("dim", Dim).field("side", side).field("sites", sites)
+           .field("disloc_number", disloc_number).field("runs", runs)
+           .field("mean_steps", double(steps) / runs).field("runs_per_sec", runs / elapsed)
+           .field("steps_per_sec", steps / elapsed)
+           .field("ns_per_site", elapsed * 1e9 / (double(steps) * sites));
+    results.close();
+    std::cerr << engine << " cycle " << Dim << "d side " << side << " K " << disloc_number
+              << ": " << runs / elapsed << " runs/s\n";
+}
+
+// Steps one large square with Crystal::step(pool) on pools of 1, 2, 4, ...
+// workers up to the hardware threads, to show how the strips scale.
+void bench_strips(JsonArray& results, unsigned int side, double density, double work){
+    std::size_t sites = std::size_t(side) * side;
+    CounterGenerator<> r_gen(RunKey{1, sites});
+    std::bernoulli_distribution placed(density);
+    bool* scheme = new bool[sites];
+    for (std::size_t i = 0; i < sites; i++){
+        scheme[i] = placed(r_gen);
+    }
+    unsigned int steps = std::max(5.0, std::min(1000.0, work / sites));
+    unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; ; threads = std::min(2 * threads, hardware)){
+        ThreadPool pool(threads);
+        Crystal<2> crystal(scheme, side, RunKey{1, 0});
+        Clock::time_point start = Clock::now();
+        for (unsigned int s = 0; s < steps; s++){
+            crystal.step(pool);
+        }
+        double elapsed = seconds_since(start);
+        results.field("engine", "crystal").field("side", side).field("density", density)
+               .field("threads", threads).field("steps", steps).field("steps_per_sec", steps / elapsed)
+               .field("ns_per_site", elapsed * 1e9 / (double(sites) * steps));
+        results.close();
+        std::cerr << "crystal strips side " << side << " threads " << threads
+                  << ": " << elapsed * 1e9 / (double(sites) * steps) << " ns/site\n";
+        if (threads == hardware){
+            break;
+        }
+    }
+    delete[] scheme;
+}
+
+template <unsigned int Dim>
+void bench_all_phases(JsonArray& results, const std::vector<unsigned int>& sides,
+                      const std::vector<double>& densities, double work){
+    for (unsigned int side : sides){
+        for (double density : densities){
+            bench_phases<Dim, Crystal>(results, "crystal", side, density, work);
+            bench_phases<Dim, BitCrystal>(results, "bit", side, density, work);
+            bench_phases<Dim, SparseCrystal>(results, "sparse", side, density, work);
+        }
+    }
+}
+
+// The square lattice against the Moore and hexagonal ones, on Crystal.
+void bench_lattices(JsonArray& results, const std::vector<unsigned int>& sides,
+                    const std::vector<double>& densities, double work){
+    for (unsigned int side : sides){
+        for (double density : densities){
+            bench_phases<2, MooreCrystal>(results, "moore", side, density, work);
+            bench_phases<2, HexCrystal>(results, "hex", side, density, work);
+        }
+    }
+}
+
+template <unsigned int Dim>
+void bench_all_cycles(JsonArray& results, unsigned int side, unsigned int disloc_number, double min_seconds){
+    bench_cycle<Dim, Crystal>(results, "crystal", side, disloc_number, min_seconds);
+    bench_cycle<Dim, BitCrystal>(results, "bit", side, disloc_number, min_seconds);
+    bench_cycle<Dim, SparseCrystal>(results, "sparse", side, disloc_number, min_seconds);
+    bench_cycle<Dim, ReplicaCrystal>(results, "replica", side, disloc_number, min_seconds);
+}
+
+int main(int argc, char** argv){
+
+    bool quick = false;
+    std::string output;
+    for (int i = 1; i < argc; i++){
+        if (std::string(argv[i]) == "--quick"){
+            quick = true;
+        }
+        if (std::string(argv[i]) == "--output" && i + 1 < argc){
+            output = argv[++i];
+        }
+    }
+
+    std::vector<unsigned int> chains = {1000, 10000, 100000, 1000000};
+    std::vector<unsigned int> squares = {64, 256, 1024, 4096};
+    std::vector<double> densities = {0.01, 0.1, 0.3};
+    double work = 2e8;
+    double min_seconds = 0.5;
+    if (quick){
+        chains = {1000, 100000};
+        squares = {64, 512};
+        densities = {0.01, 0.3};
+        work = 2e7;
+        min_seconds = 0.05;
+    }
+
+    JsonArray phases;
+    bench_all_phases<1>(phases, chains, densities, work);
+    bench_all_phases<2>(phases, squares, densities, work);
+    bench_lattices(phases, squares, densities, work);
+
+    JsonArray strips;
+    bench_strips(strips, squares.back(), 0.1, work);
+
+    JsonArray cycles;
+    bench_all_cycles<1>(cycles, 20, 1, min_seconds);
+    bench_all_cycles<1>(cycles, 20, 10, min_seconds);
+    bench_all_cycles<2>(cycles, 4, 3, min_seconds);
+    bench_all_cycles<2>(cycles, 5, 5, min_seconds);
+    bench_all_cycles<2>(cycles, 5, 12, min_seconds);
+    bench_all_cycles<2>(cycles, 30, 1, min_seconds);
+
+    std::ofstream file;
+    if (!output.empty()){
+        file.open(output, std::ios::out);
+    }
+    std::ostream& out = output.empty() ? std::cout : file;
+#ifdef __AVX2__
+    const char* lane = "avx2";
+#else
+    const char* lane = "scalar";
+#endif
+    out << "{\n  \"lane\": \"" << lane << "\",\n  \"phases\": ";
+    phases.write(out, "  ");
+    out << ",\n  \"strips\": ";
+    strips.write(out, "  ");
+    out << ",\n  \"cycles\": ";
+    cycles.write(out, "  ");
+    out << "\n}\n";
+    return 0;
+}
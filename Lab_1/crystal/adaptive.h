@@ -0,0 +1,130 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "experiment.h"
+#include "parallel.h"
+#include "random.h"
+
+// Sample mean of the relaxation time with its standard error.
+struct Estimate{
+    long double mean;
+    long double error;
+    unsigned long long samples;
+};
+
+const unsigned long long pilot_samples = 1000;
+const unsigned long long batch_samples = 1024;
+
+// Welford's running mean and sum of squared deviations.
+class Tally{
+    private:
+        long double mean;
+        long double squares;
+        unsigned long long n;
+    public:
+        Tally(){
+            this->mean = 0;
+            this->squares = 0;
+            this->n = 0;
+        }
+        void add(long double value){
+            this->n++;
+            long double delta = value - this->mean;
+            this->mean += delta / this->n;
+            this->squares += delta * (value - this->mean);
+        }
+        unsigned long long samples(){
+            return this->n;
+        }
+        long double variance(){
+            return this->n > 1 ? this->squares / (this->n - 1) : 0;
+        }
+        Estimate estimate(){
+            return Estimate{this->mean, std::sqrt(this->variance() / std::max(this->n, 1ull)), this->n};
+        }
+};
+
+// Relaxes samples [begin, end) of a sweep point on pool and returns their
+// relaxation times in sample order. Sample i places the dislocations and
+// draws its directions from RunKey{key, i}.
+template <unsigned int Dim, template <unsigned int> class Engine>
+std::vector<int> sample_runs(unsigned int K, unsigned int size, std::uint64_t key,
+                             unsigned long long begin, unsigned long long end, ThreadPool& pool){
+    unsigned int N = 1;
+    for (unsigned int d = 0; d < Dim; d++){
+        N *= size;
+    }
+    unsigned int threads = pool.size();
+    unsigned long long count = end - begin;
+    std::vector<int> values(count);
+    pool.run([&](unsigned int worker){
+        bool* scheme = new bool[N];
+        std::vector<unsigned int> sites(N);
+        for (unsigned long long i = count * worker / threads; i < count * (worker + 1) / threads; i++){
+            RunKey run{key, begin + i};
+            CounterGenerator<> pick(run);
+            std::iota(sites.begin(), sites.end(), 0);
+            std::fill_n(scheme, N, false);
+            for (unsigned int k = 0; k < K; k++){
+                std::swap(sites[k], sites[k + pick() % (N - k)]);
+                scheme[sites[k]] = true;
+            }
+            values[i] = cycle<Dim, Engine>(scheme, size, run);
+        }
+        delete[] scheme;
+    });
+    return values;
+}
+
+// Samples random placements of disloc_number dislocations until the
+// relative standard error of the mean reaches relative_error or
+// budget_seconds have passed, whichever comes first.
+//
+// A pilot of pilot_samples runs estimates the spread, which fixes how many
+// fresh samples the target needs; only those are averaged. Stopping as soon
+// as the running error looks small would favour runs that happened to come
+// out long, since those make the relative error look smaller.
+// The samples are independent of the worker count, so for a given seed the
+// estimate is reproducible unless the budget cuts the run short.
+template <unsigned int Dim, template <unsigned int> class Engine = Crystal>
+Estimate adaptive_run(unsigned int disloc_number, unsigned int size, double relative_error,
+                      double budget_seconds, std::uint64_t seed = random_seed(),
+                      ThreadPool& pool = default_pool()){
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t key = point_seed(seed, Dim, size, disloc_number);
+
+    Tally pilot;
+    for (int value : sample_runs<Dim, Engine>(disloc_number, size, key, 0, pilot_samples, pool)){
+        pilot.add(value);
+    }
+    Estimate guess = pilot.estimate();
+    long double wanted = relative_error * guess.mean;
+    if (guess.mean == 0 || pilot.variance() <= wanted * wanted * pilot_samples){
+        return guess;
+    }
+    unsigned long long needed = std::ceil(pilot.variance() / (wanted * wanted));
+
+    Tally tally;
+    unsigned long long next = pilot_samples;
+    while (tally.samples() < needed){
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= budget_seconds){
+            break;
+        }
+        unsigned long long count = std::min(batch_samples, needed - tally.samples());
+        for (int value : sample_runs<Dim, Engine>(disloc_number, size, key, next, next + count, pool)){
+            tally.add(value);
+        }
+        next += count;
+    }
+    return tally.samples() ? tally.estimate() : guess;
+}
+
+#endif
@@ -0,0 +1,420 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include "crystal.h"
+#include "instrument.h"
+#include "memory.h"
+#include "random.h"
+
+// Gathers bits 0, 2, 4, ... of x into the low 32 bits.
+inline std::uint64_t even_bits(std::uint64_t x){
+#ifdef __BMI2__
+    return _pext_u64(x, 0x5555555555555555);
+#else
+    x &= 0x5555555555555555;
+    x = (x | (x >> 1)) & 0x3333333333333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FF;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFF;
+    return (x | (x >> 16)) & 0x00000000FFFFFFFF;
+#endif
+}
+
+// Word-parallel operations on packed rows. Every row is stored with one zero
+// guard word on each side, so the sideways neighbour of a word can always be
+// read as p[-1] or p[1] without a bounds check.
+struct ScalarLane{
+    typedef std::uint64_t Word;
+    static constexpr unsigned int width = 1;
+
+    static Word load(const std::uint64_t* p){
+        return p[0];
+    }
+    static void store(std::uint64_t* p, Word w){
+        p[0] = w;
+    }
+    static Word zero(){
+        return 0;
+    }
+    static Word bit_and(Word a, Word b){
+        return a & b;
+    }
+    static Word bit_or(Word a, Word b){
+        return a | b;
+    }
+    static Word and_not(Word a, Word b){
+        return a & ~b;
+    }
+    static bool any(Word a){
+        return a != 0;
+    }
+    // Bit j of the result is bit j - 1 of the row, i.e. the left neighbour.
+    static Word from_left(const std::uint64_t* p){
+        return (p[0] << 1) | (p[-1] >> 63);
+    }
+    // Bit j of the result is bit j + 1 of the row, i.e. the right neighbour.
+    static Word from_right(const std::uint64_t* p){
+        return (p[0] >> 1) | (p[1] << 63);
+    }
+};
+
+#ifdef __AVX2__
+struct Avx2Lane{
+    typedef __m256i Word;
+    static constexpr unsigned int width = 4;
+
+    static Word load(const std::uint64_t* p){
+        return _mm256_loadu_si256((const __m256i*)p);
+    }
+    static void store(std::uint64_t* p, Word w){
+        _mm256_storeu_si256((__m256i*)p, w);
+    }
+    static Word zero(){
+        return _mm256_setzero_si256();
+    }
+    static Word bit_and(Word a, Word b){
+        return _mm256_and_si256(a, b);
+    }
+    static Word bit_or(Word a, Word b){
+        return _mm256_or_si256(a, b);
+    }
+    static Word and_not(Word a, Word b){
+        return _mm256_andnot_si256(b, a);
+    }
+    static bool any(Word a){
+        return !_mm256_testz_si256(a, a);
+    }
+    static Word from_left(const std::uint64_t* p){
+        return _mm256_or_si256(_mm256_slli_epi64(load(p), 1),
+                               _mm256_srli_epi64(load(p - 1), 63));
+    }
+    static Word from_right(const std::uint64_t* p){
+        return _mm256_or_si256(_mm256_srli_epi64(load(p), 1),
+                               _mm256_slli_epi64(load(p + 1), 63));
+    }
+};
+typedef Avx2Lane Lane;
+#else
+typedef ScalarLane Lane;
+#endif
+
+// Same model as Crystal<Dim>, with the lattice held as bit planes: one bit
+// per site for the state (set = dislocation) and for activity, packed 64
+// sites to a word along the fastest axis. Contacts and move conflicts are
+// resolved for a whole word of sites with shifts and masks. On 2- and
+// 4-way lattices the directions of a whole word are unpacked into the move
+// planes from one generator call; they are the same draws Crystal makes,
+// so both engines follow the same path for the same RunKey.
+template <unsigned int Dim>
+class BitCrystal{
+    public:
+        typedef Neighbourhood<Dim> Stencil;
+        typedef std::array<unsigned int, Dim> Extent;
+    private:
+        typedef std::vector<std::uint64_t, HugePageAllocator<std::uint64_t>> Plane;
+
+        Extent extent;
+        unsigned int width;
+        std::size_t rows;
+        Directions<Stencil::size> directions;
+        std::uint64_t steps;
+        std::size_t words;
+        std::size_t stride;
+        bool running;
+
+        // A move in direction d goes row_delta[d] rows and col_delta[d]
+        // columns; priority lists the directions in the order a contested
+        // site is granted, i.e. by the scan position of the mover.
+        std::array<std::ptrdiff_t, Stencil::size> row_delta;
+        std::array<int, Stencil::size> col_delta;
+        std::array<unsigned int, Stencil::size> priority;
+
+        std::vector<std::size_t> interior_rows;
+        Plane state;
+        Plane next;
+        Plane active;
+        std::array<Plane, Stencil::size> moves;
+        std::vector<std::uint64_t> arrival;
+        std::vector<std::uint64_t> taken;
+
+        std::uint64_t* row(Plane& plane, std::size_t r){
+            return plane.data() + r * this->stride + 1;
+        }
+        bool is_border_row(std::size_t r){
+            for (int d = int(Dim) - 2; d >= 0; d--){
+                unsigned int coord = r % this->extent[d];
+                r /= this->extent[d];
+                if (coord == 0 || coord == this->extent[d] - 1){
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Number of set bits in plane that are also set in mask, for the
+        // instrumentation counts.
+        std::uint64_t count_common(Plane& plane, Plane& mask){
+            std::uint64_t n = 0;
+            for (std::size_t r = 0; r < this->rows; r++){
+                std::uint64_t* p = this->row(plane, r);
+                std::uint64_t* m = this->row(mask, r);
+                for (std::size_t k = 0; k < this->words; k++){
+                    n += __builtin_popcountll(p[k] & m[k]);
+                }
+            }
+            return n;
+        }
+        static Lane::Word shifted(const std::uint64_t* p, int col_delta){
+            if (col_delta > 0){
+                return Lane::from_left(p);
+            }
+            if (col_delta < 0){
+                return Lane::from_right(p);
+            }
+            return Lane::load(p);
+        }
+    public:
+        BitCrystal(const bool* scheme, Extent extent, RunKey key = RunKey{random_seed(), 0})
+            : directions(key, extent[Dim - 1]){
+            this->extent = extent;
+            this->width = extent[Dim - 1];
+            this->rows = 1;
+            for (unsigned int d = 0; d + 1 < Dim; d++){
+                this->rows *= extent[d];
+            }
+            this->words = (this->width + 63) / 64;
+            this->words = (this->words + Lane::width - 1) / Lane::width * Lane::width;
+            this->stride = this->words + 2;
+            this->running = true;
+            this->steps = 0;
+
+            std::array<std::ptrdiff_t, Stencil::size> offset = Stencil::offsets(extent);
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                bool sideways = offset[d] == 1 || offset[d] == -1;
+                this->col_delta[d] = sideways ? int(offset[d]) : 0;
+                this->row_delta[d] = sideways ? 0 : offset[d] / std::ptrdiff_t(this->width);
+                this->priority[d] = d;
+            }
+            std::sort(this->priority.begin(), this->priority.end(),
+                      [&offset](unsigned int a, unsigned int b){
+                          return offset[a] > offset[b];
+                      });
+
+            std::size_t plane = this->rows * this->stride;
+            this->state.assign(plane, 0);
+            this->next.assign(plane, 0);
+            this->active.assign(plane, 0);
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                this->moves[d].assign(plane, 0);
+            }
+            this->arrival.assign(this->stride, 0);
+            this->taken.assign(this->stride, 0);
+            for (std::size_t r = 0; r < this->rows; r++){
+                if (!this->is_border_row(r)){
+                    this->interior_rows.push_back(r);
+                }
+            }
+            this->reset(SchemeView(scheme, this->rows * this->width), key);
+        }
+        BitCrystal(const bool* scheme, unsigned int side, RunKey key = RunKey{random_seed(), 0})
+            : BitCrystal(scheme, Crystal<Dim>::cube(side), key){}
+
+        // Starts a new run from scheme with the draws of key, in the planes
+        // already allocated.
+        void reset(SchemeView scheme, RunKey key){
+            if (scheme.size != this->rows * this->width){
+                throw std::invalid_argument("scheme does not fit the crystal");
+            }
+            this->directions = Directions<Stencil::size>(key, this->width);
+            this->running = true;
+            this->steps = 0;
+            std::fill(this->state.begin(), this->state.end(), 0);
+            std::fill(this->next.begin(), this->next.end(), 0);
+            std::fill(this->active.begin(), this->active.end(), 0);
+            for (Plane& plane : this->moves){
+                std::fill(plane.begin(), plane.end(), 0);
+            }
+            for (std::size_t r = 0; r < this->rows; r++){
+                std::uint64_t* s = this->row(this->state, r);
+                for (unsigned int j = 0; j < this->width; j++){
+                    if (scheme[r * this->width + j]){
+                        s[j / 64] |= std::uint64_t(1) << (j % 64);
+                    }
+                }
+            }
+            for (std::size_t r : this->interior_rows){
+                std::uint64_t* a = this->row(this->active, r);
+                for (unsigned int j = 1; j + 1 < this->width; j++){
+                    a[j / 64] |= std::uint64_t(1) << (j % 64);
+                }
+            }
+        }
+
+        bool is_running(){
+            return this->running;
+        }
+        bool is_dislocation(std::size_t index){
+            std::size_t r = index / this->width;
+            unsigned int j = index % this->width;
+            return (this->row(this->state, r)[j / 64] >> (j % 64)) & 1;
+        }
+        void check_activity(){
+            PhaseTimer timer(ActivityCheck);
+            this->running = false;
+            for (std::size_t r : this->interior_rows){
+                std::uint64_t* s = this->row(this->state, r);
+                std::uint64_t* a = this->row(this->active, r);
+                for (std::size_t k = 0; k < this->words; k += Lane::width){
+                    if (Lane::any(Lane::bit_and(Lane::load(s + k), Lane::load(a + k)))){
+                        this->running = true;
+                        return;
+                    }
+                }
+            }
+        }
+        void update_activity(){
+            PhaseTimer timer(ActivityUpdate);
+            std::uint64_t before = 0;
+            if constexpr (instrumented){
+                before = this->count_common(this->state, this->active);
+            }
+            for (std::size_t r : this->interior_rows){
+                std::uint64_t* s = this->row(this->state, r);
+                std::uint64_t* a = this->row(this->active, r);
+                for (std::size_t k = 0; k < this->words; k += Lane::width){
+                    Lane::Word contact = Lane::zero();
+                    for (unsigned int d = 0; d < Stencil::size; d++){
+                        const std::uint64_t* n = this->row(this->state, r + this->row_delta[d]) + k;
+                        contact = Lane::bit_or(contact, shifted(n, -this->col_delta[d]));
+                    }
+                    contact = Lane::bit_and(contact, Lane::load(s + k));
+                    Lane::store(a + k, Lane::and_not(Lane::load(a + k), contact));
+                }
+            }
+            if constexpr (instrumented){
+                count_event(Deactivation, before - this->count_common(this->state, this->active));
+            }
+        }
+        void calculate_state(){
+            PhaseTimer timer(StateCalculation);
+            typedef Directions<Stencil::size> Random;
+            std::uint64_t proposed = 0;
+            for (std::size_t r : this->interior_rows){
+                std::uint64_t* s = this->row(this->state, r);
+                std::uint64_t* a = this->row(this->active, r);
+                std::array<std::uint64_t*, Stencil::size> m;
+                for (unsigned int d = 0; d < Stencil::size; d++){
+                    m[d] = this->row(this->moves[d], r);
+                    std::fill_n(m[d], this->words, 0);
+                }
+                for (std::size_t k = 0; k < this->words; k++){
+                    std::uint64_t movers = s[k] & a[k];
+                    if (!movers){
+                        continue;
+                    }
+                    if constexpr (instrumented){
+                        proposed += __builtin_popcountll(movers);
+                    }
+                    std::uint64_t bits[2];
+                    if constexpr (Random::packed && Random::bits == 2){
+                        this->directions.block(this->steps, r, k, bits);
+                        std::uint64_t lo = even_bits(bits[0]) | even_bits(bits[1]) << 32;
+                        std::uint64_t hi = even_bits(bits[0] >> 1) | even_bits(bits[1] >> 1) << 32;
+                        m[0][k] = movers & ~hi & ~lo;
+                        m[1][k] = movers & ~hi & lo;
+                        m[2][k] = movers & hi & ~lo;
+                        m[3][k] = movers & hi & lo;
+                    }
+                    else if constexpr (Random::packed && Random::bits == 1){
+                        this->directions.block(this->steps, r, k / 2, bits);
+                        m[0][k] = movers & ~bits[k % 2];
+                        m[1][k] = movers & bits[k % 2];
+                    }
+                    else{
+                        while (movers){
+                            unsigned int b = __builtin_ctzll(movers);
+                            unsigned int d = this->directions.get(this->steps, r, k * 64 + b);
+                            m[d][k] |= std::uint64_t(1) << b;
+                            movers &= movers - 1;
+                        }
+                    }
+                }
+            }
+            this->steps++;
+
+            // Grant every contested site to the first mover in scan order,
+            // then turn each move plane into the moves that went through.
+            for (std::size_t t = 0; t < this->rows; t++){
+                std::uint64_t* taken = this->taken.data() + 1;
+                std::uint64_t* next = this->row(this->next, t);
+                std::fill_n(taken, this->words, 0);
+                for (unsigned int d : this->priority){
+                    std::ptrdiff_t src = std::ptrdiff_t(t) - this->row_delta[d];
+                    if (src < 0 || src >= std::ptrdiff_t(this->rows)){
+                        continue;
+                    }
+                    std::uint64_t* m = this->row(this->moves[d], src);
+                    std::uint64_t* won = this->arrival.data() + 1;
+                    for (std::size_t k = 0; k < this->words; k += Lane::width){
+                        Lane::Word in = shifted(m + k, this->col_delta[d]);
+                        Lane::Word t_k = Lane::load(taken + k);
+                        Lane::store(won + k, Lane::and_not(in, t_k));
+                        Lane::store(taken + k, Lane::bit_or(t_k, in));
+                    }
+                    for (std::size_t k = 0; k < this->words; k += Lane::width){
+                        Lane::store(m + k, shifted(won + k, -this->col_delta[d]));
+                    }
+                }
+                std::copy_n(taken, this->words, next);
+            }
+            if constexpr (instrumented){
+                std::uint64_t granted = 0;
+                for (unsigned int d = 0; d < Stencil::size; d++){
+                    granted += this->count_common(this->moves[d], this->moves[d]);
+                }
+                count_event(MoveProposed, proposed);
+                count_event(MoveBlocked, proposed - granted);
+            }
+        }
+        void update_state(){
+            PhaseTimer timer(StateUpdate);
+            for (std::size_t r = 0; r < this->rows; r++){
+                std::uint64_t* s = this->row(this->state, r);
+                std::uint64_t* next = this->row(this->next, r);
+                if (!this->is_border_row(r)){
+                    for (std::size_t k = 0; k < this->words; k += Lane::width){
+                        Lane::Word moved = Lane::zero();
+                        for (unsigned int d = 0; d < Stencil::size; d++){
+                            moved = Lane::bit_or(moved, Lane::load(this->row(this->moves[d], r) + k));
+                        }
+                        Lane::store(next + k, Lane::bit_or(Lane::load(next + k),
+                                                           Lane::and_not(Lane::load(s + k), moved)));
+                    }
+                }
+                else{
+                    for (std::size_t k = 0; k < this->words; k += Lane::width){
+                        Lane::store(next + k, Lane::bit_or(Lane::load(next + k), Lane::load(s + k)));
+                    }
+                }
+            }
+            this->state.swap(this->next);
+        }
+        void step(){
+            this->update_activity();
+            this->check_activity();
+            this->calculate_state();
+            this->update_state();
+        }
+};
+
+#endif
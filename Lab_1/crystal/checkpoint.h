@@ -0,0 +1,162 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "experiment.h"
+#include "parallel.h"
+#include "random.h"
+
+// Resumable position in a parameter sweep that writes one line per point
+// to output. The checkpoint file holds the sweep seed, the number of
+// finished points with the length of output after the last of them, and
+// for the point in progress its (size, K), the next run and the partial
+// move sum. Directions are counter-based, so this is the whole RNG state.
+//
+// A restarted sweep skips the finished points, cuts output back to the
+// recorded length (dropping a line written after the last save) and
+// carries on from the saved run, which gives the same file as a run that
+// was never interrupted.
+class Checkpoint{
+    private:
+        std::string path;
+        std::string output;
+        std::uint64_t seed;
+        double interval;
+        bool resumed;
+        unsigned long long visited;
+        unsigned long long done;
+        std::uintmax_t length;
+        unsigned int size;
+        unsigned int K;
+        unsigned long long run;
+        long long unsigned int moves;
+
+        void save(){
+            std::string temporary = this->path + ".tmp";
+            {
+                std::ofstream file(temporary, std::ios::out | std::ios::trunc);
+                file << this->seed << " " << this->done << " " << this->length << " "
+                     << this->size << " " << this->K << " " << this->run << " " << this->moves << "\n";
+                file.flush();
+                if (!file){
+                    throw std::runtime_error("cannot write checkpoint " + temporary);
+                }
+            }
+            std::filesystem::rename(temporary, this->path);
+        }
+    public:
+        // Loads path if it exists, otherwise starts a new sweep with seed.
+        // interval is the number of seconds between saves inside a point.
+        Checkpoint(const std::string& path, const std::string& output,
+                   std::uint64_t seed = random_seed(), double interval = 60){
+            this->path = path;
+            this->output = output;
+            this->seed = seed;
+            this->interval = interval;
+            this->visited = 0;
+            this->done = 0;
+            this->length = 0;
+            this->size = 0;
+            this->K = 0;
+            this->run = 0;
+            this->moves = 0;
+            std::ifstream file(path);
+            this->resumed = bool(file >> this->seed >> this->done >> this->length
+                                      >> this->size >> this->K >> this->run >> this->moves);
+            if (file.is_open() && !this->resumed){
+                throw std::runtime_error("corrupt checkpoint " + path);
+            }
+            if (this->resumed && std::filesystem::exists(output)
+                && std::filesystem::file_size(output) > this->length){
+                std::filesystem::resize_file(output, this->length);
+            }
+        }
+        std::uint64_t sweep_seed(){
+            return this->seed;
+        }
+        // Mode to open output with: append after a resume, else truncate.
+        std::ios::openmode mode(){
+            return this->resumed ? std::ios::app : std::ios::out;
+        }
+        // Moves on to the next point of the sweep; true if that point was
+        // already finished before the restart and must not be redone.
+        bool skip(){
+            return this->visited++ < this->done;
+        }
+        // test_sum for runs [begin, end) of the current point, saving the
+        // partial sum every interval seconds. The sum is an integer, so
+        // neither the saves nor a restart change the result.
+        template <unsigned int Dim, template <unsigned int> class Engine = Crystal>
+        long long unsigned int test_sum(unsigned int disloc_number, unsigned int size,
+                                        unsigned long long begin, unsigned long long end,
+                                        ThreadPool& pool = default_pool()){
+            std::uint64_t key = point_seed(this->seed, Dim, size, disloc_number);
+            if (this->size != size || this->K != disloc_number){
+                if (this->run != 0){
+                    throw std::runtime_error("checkpoint " + this->path + " belongs to another sweep");
+                }
+                this->size = size;
+                this->K = disloc_number;
+            }
+            if (this->run > end){
+                throw std::runtime_error("checkpoint " + this->path + " belongs to another sweep");
+            }
+            this->run = std::max(this->run, begin);
+
+            // Chunks grow until one takes about a second, so that short
+            // points are not slowed down by the bookkeeping.
+            unsigned long long chunk = pool.size();
+            auto saved = std::chrono::steady_clock::now();
+            while (this->run < end){
+                unsigned long long last = std::min(end, this->run + chunk);
+                auto start = std::chrono::steady_clock::now();
+                this->moves += ::test_sum<Dim, Engine>(disloc_number, size, key, this->run, last, pool);
+                this->run = last;
+                auto now = std::chrono::steady_clock::now();
+                if (std::chrono::duration<double>(now - start).count() < 1){
+                    chunk *= 2;
+                }
+                if (this->run < end && std::chrono::duration<double>(now - saved).count() >= this->interval){
+                    this->save();
+                    saved = now;
+                }
+            }
+            return this->moves;
+        }
+        // test_run for the current point, i.e. test_sum over all its runs.
+        template <unsigned int Dim, template <unsigned int> class Engine = Crystal>
+        long double test_run(unsigned int disloc_number, unsigned int size, int repeat_number,
+                             ThreadPool& pool = default_pool()){
+            unsigned int N = 1;
+            for (unsigned int d = 0; d < Dim; d++){
+                N *= size;
+            }
+            unsigned long long total = binomial(N, disloc_number) * repeat_number;
+            long long unsigned int moves = this->test_sum<Dim, Engine>(disloc_number, size, 0, total, pool);
+            return (long double)(moves) / total;
+        }
+        // Records that the current point's line has been written to out.
+        void finish(std::ostream& out){
+            out.flush();
+            this->done = this->visited;
+            this->length = std::filesystem::file_size(this->output);
+            this->size = 0;
+            this->K = 0;
+            this->run = 0;
+            this->moves = 0;
+            this->save();
+        }
+        // Removes the checkpoint once the sweep is complete.
+        void close(){
+            std::filesystem::remove(this->path);
+        }
+};
+
+#endif
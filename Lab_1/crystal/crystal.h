@@ -0,0 +1,601 @@
+#ifndef CRYSTAL_H
+#define CRYSTAL_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "instrument.h"
+#include "memory.h"
+#include "parallel.h"
+#include "random.h"
+
+// One byte per site in each plane of Crystal.
+enum State : unsigned char {Dislocation, Atom};
+
+// Read-only view of a placement: one flag per site, set for a dislocation,
+// in the row-major order of the engines. It owns nothing, so the same
+// buffer can be refilled and handed to reset() run after run.
+struct SchemeView{
+    const bool* sites;
+    std::size_t size;
+
+    SchemeView(const bool* sites, std::size_t size){
+        this->sites = sites;
+        this->size = size;
+    }
+    bool operator[](std::size_t index) const{
+        return this->sites[index];
+    }
+};
+
+// Neighbourhoods of a Dim-dimensional lattice stored row-major in one flat
+// buffer. extent lists the sizes from the slowest axis to the fastest, so
+// a 2D crystal is {height, width} like the old matrix[height][width].
+//
+// A stencil is a constexpr table: moves[v][d] is the step of direction d
+// along every axis, slowest first, in rows of variant v, and opposite[d]
+// the direction that undoes d. Most lattices have one variant; the
+// hexagonal one in offset coordinates has two, for even and odd rows. The
+// direction order fixes which random number means which move.
+template <class Stencil, unsigned int Dim>
+std::array<std::ptrdiff_t, Stencil::size> stencil_offsets(const std::array<unsigned int, Dim>& extent,
+                                                          unsigned int variant = 0){
+    std::array<std::ptrdiff_t, Stencil::size> offsets;
+    for (unsigned int d = 0; d < Stencil::size; d++){
+        std::ptrdiff_t offset = 0;
+        for (unsigned int a = 0; a < Dim; a++){
+            offset = offset * std::ptrdiff_t(extent[a]) + Stencil::moves[variant][d][a];
+        }
+        offsets[d] = offset;
+    }
+    return offsets;
+}
+
+// The von Neumann neighbourhood: one step along one axis.
+template <unsigned int Dim>
+struct Neighbourhood;
+
+template <>
+struct Neighbourhood<1>{
+    enum Direction {Left, Right};
+    static constexpr unsigned int size = 2;
+    static constexpr unsigned int variants = 1;
+    static constexpr int moves[variants][size][1] = {{{-1}, {1}}};
+    static constexpr unsigned int opposite[size] = {Right, Left};
+    static std::array<std::ptrdiff_t, size> offsets(const std::array<unsigned int, 1>& extent){
+        return stencil_offsets<Neighbourhood<1>, 1>(extent);
+    }
+};
+
+template <>
+struct Neighbourhood<2>{
+    enum Direction {Left, Down, Up, Right};
+    static constexpr unsigned int size = 4;
+    static constexpr unsigned int variants = 1;
+    static constexpr int moves[variants][size][2] = {{{0, -1}, {1, 0}, {-1, 0}, {0, 1}}};
+    static constexpr unsigned int opposite[size] = {Right, Up, Down, Left};
+    static std::array<std::ptrdiff_t, size> offsets(const std::array<unsigned int, 2>& extent){
+        return stencil_offsets<Neighbourhood<2>, 2>(extent);
+    }
+};
+
+template <>
+struct Neighbourhood<3>{
+    enum Direction {Left, Down, Up, Right, Front, Back};
+    static constexpr unsigned int size = 6;
+    static constexpr unsigned int variants = 1;
+    static constexpr int moves[variants][size][3] = {{{0, 0, -1}, {0, 1, 0}, {0, -1, 0},
+                                                      {0, 0, 1}, {1, 0, 0}, {-1, 0, 0}}};
+    static constexpr unsigned int opposite[size] = {Right, Up, Down, Left, Back, Front};
+    static std::array<std::ptrdiff_t, size> offsets(const std::array<unsigned int, 3>& extent){
+        return stencil_offsets<Neighbourhood<3>, 3>(extent);
+    }
+};
+
+// The eight sites around a site of a square lattice, diagonals included.
+struct Moore{
+    enum Direction {UpLeft, Up, UpRight, Left, Right, DownLeft, Down, DownRight};
+    static constexpr unsigned int size = 8;
+    static constexpr unsigned int variants = 1;
+    static constexpr int moves[variants][size][2] = {{{-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
+                                                      {0, 1}, {1, -1}, {1, 0}, {1, 1}}};
+    static constexpr unsigned int opposite[size] = {DownRight, Down, DownLeft, Right,
+                                                    Left, UpRight, Up, UpLeft};
+};
+
+// A hexagonal lattice in "odd-r" offset coordinates: every odd row is
+// shifted half a site to the right, so the diagonal neighbours of a site
+// depend on the parity of its row. A periodic hexagonal lattice needs an
+// even number of rows.
+struct Hexagonal{
+    enum Direction {UpLeft, UpRight, Left, Right, DownLeft, DownRight};
+    static constexpr unsigned int size = 6;
+    static constexpr unsigned int variants = 2;
+    static constexpr int moves[variants][size][2] = {
+        {{-1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, -1}, {1, 0}},
+        {{-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, 0}, {1, 1}}};
+    static constexpr unsigned int opposite[size] = {DownRight, DownLeft, Right, Left, UpRight, UpLeft};
+};
+
+// Boundary conditions of Crystal, chosen at compile time. Absorbing is the
+// original model: the sites on the faces of the lattice are deactivated,
+// so a dislocation that reaches one freezes there. Periodic joins opposite
+// faces, so every site is in the bulk. Reflecting leaves the faces open and
+// replaces a move off the lattice by the opposite move. wrap() maps a
+// coordinate one step outside an axis of extent sites, without branches;
+// it is only asked for sites on a face.
+struct Absorbing{
+    static constexpr bool border = true;
+    static constexpr bool wraps = false;
+    static long wrap(long coord, unsigned int){
+        return coord;
+    }
+};
+
+struct Periodic{
+    static constexpr bool border = false;
+    static constexpr bool wraps = true;
+    static long wrap(long coord, unsigned int extent){
+        coord += long(coord < 0) * long(extent);
+        coord -= long(coord >= long(extent)) * long(extent);
+        return coord;
+    }
+};
+
+struct Reflecting{
+    static constexpr bool border = false;
+    static constexpr bool wraps = false;
+    static long wrap(long coord, unsigned int){
+        return coord;
+    }
+};
+
+template <unsigned int Dim, class Boundary = Absorbing, class Neighbours = Neighbourhood<Dim>>
+class Crystal{
+    public:
+        typedef Neighbours Stencil;
+        typedef std::array<unsigned int, Dim> Extent;
+        static_assert(sizeof(Stencil::moves[0][0]) == Dim * sizeof(int), "the stencil is for another dimension");
+    private:
+        typedef std::vector<unsigned char, HugePageAllocator<unsigned char>> Plane;
+
+        // Row-major planes, so that the fused step visits every site in scan
+        // order and a vertical neighbour is one row, i.e. one band at most,
+        // away. now and next point into states and hold the same state
+        // between steps: a step reads now, applies its moves to next and
+        // swaps the two. active marks the sites that may still move.
+        Plane states[2];
+        Plane active;
+        State* now;
+        State* next;
+        Extent extent;
+        std::array<std::size_t, Dim> stride;
+        // Index offset of every move in rows of each variant.
+        std::array<std::array<std::ptrdiff_t, Stencil::size>, Stencil::variants> offset;
+        std::size_t size;
+        unsigned int width;
+        bool running;
+        Directions<Stencil::size> directions;
+        std::uint64_t steps;
+        // Longest move offset, and sites per band of the fused step: whole
+        // rows, at least reach of them.
+        std::size_t reach;
+        std::size_t band;
+        // Moves step(pool) left to the edges of the strips, as pairs of
+        // mover and target: two lists per strip, for its upper and lower edge.
+        std::vector<std::vector<std::size_t>> deferred;
+        // Moves granted in the current step, as pairs of origin and target:
+        // one list per strip of step(pool), the first for everything else.
+        std::vector<std::vector<std::size_t>> moved;
+
+        bool is_border_row(std::size_t row){
+            for (int d = int(Dim) - 2; d >= 0; d--){
+                unsigned int coord = row % this->extent[d];
+                row /= this->extent[d];
+                if (coord == 0 || coord == this->extent[d] - 1){
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Calls f(row, column, face) for every site with index in [begin,
+        // end) that can hold a moving dislocation, in row-major order; the
+        // site itself is matrix[row * width + column], and face tells
+        // whether it lies on a face of the lattice, where its neighbours
+        // come from neighbour(). Absorbing lattices skip the faces.
+        template <typename F>
+        void for_each_site(std::size_t begin, std::size_t end, F f){
+            if (begin >= end){
+                return;
+            }
+            for (std::size_t row = begin / this->width; row <= (end - 1) / this->width; row++){
+                bool face_row = this->is_border_row(row);
+                if (Boundary::border && face_row){
+                    continue;
+                }
+                std::size_t first = row * this->width;
+                unsigned int from = begin > first ? begin - first : 0;
+                unsigned int to = std::min<std::size_t>(this->width, end - first);
+                if (face_row){
+                    for (unsigned int j = from; j < to; j++){
+                        f(row, j, true);
+                    }
+                    continue;
+                }
+                if (from == 0){
+                    if (!Boundary::border){
+                        f(row, 0, true);
+                    }
+                    from = 1;
+                }
+                unsigned int last = std::min(to, this->width - 1);
+                for (unsigned int j = from; j < last; j++){
+                    f(row, j, false);
+                }
+                if (!Boundary::border && to == this->width && this->width > 1){
+                    f(row, this->width - 1, true);
+                }
+            }
+        }
+        // Neighbour in direction d of the site index on a face: the move
+        // itself if the boundary keeps it on the lattice, else the opposite
+        // move, else the site itself.
+        std::size_t neighbour(std::size_t index, unsigned int d){
+            unsigned int variant = index / this->width % Stencil::variants;
+            std::array<long, Dim> coord;
+            for (unsigned int a = 0; a < Dim; a++){
+                coord[a] = index / this->stride[a] % this->extent[a];
+            }
+            for (unsigned int e : {d, Stencil::opposite[d]}){
+                std::size_t moved = 0;
+                bool inside = true;
+                for (unsigned int a = 0; a < Dim; a++){
+                    long c = Boundary::wrap(coord[a] + Stencil::moves[variant][e][a], this->extent[a]);
+                    inside = inside && c >= 0 && c < long(this->extent[a]);
+                    moved += c * this->stride[a];
+                }
+                if (inside){
+                    return moved;
+                }
+            }
+            return index;
+        }
+        // Deactivates the dislocations in [begin, end) that touch another
+        // one; returns whether any active dislocation is left there.
+        bool deactivate(std::size_t begin, std::size_t end){
+            bool active = false;
+            this->for_each_site(begin, end, [this, &active](std::size_t row, unsigned int j, bool face){
+                std::size_t i = row * this->width + j;
+                if (this->now[i] == Dislocation){
+                    const std::ptrdiff_t* offset = this->offset[row % Stencil::variants].data();
+                    for (unsigned int d = 0; d < Stencil::size; d++){
+                        std::size_t n = face ? this->neighbour(i, d) : i + offset[d];
+                        if (this->now[n] == Dislocation && n != i){
+                            if (instrumented && this->active[i]){
+                                count_event(Deactivation);
+                            }
+                            this->active[i] = false;
+                            break;
+                        }
+                    }
+                    active = active || this->active[i];
+                }
+            });
+            return active;
+        }
+        // Settles the move of the dislocation on site i to target and notes
+        // it in moved if it is granted: a site goes to the first mover that
+        // claims it, and later ones stay put. Moves never land on a
+        // dislocation, and no other mover aims at site i, so next still
+        // holds the current state everywhere the step has not moved to.
+        void claim(std::size_t i, std::size_t target, std::vector<std::size_t>& moved){
+            this->next[i] = Atom;
+            if (this->next[target] == Atom){
+                this->next[target] = Dislocation;
+                moved.push_back(i);
+                moved.push_back(target);
+            }
+            else{
+                count_event(MoveBlocked);
+                this->next[i] = Dislocation;
+            }
+        }
+        // Draws the moves of the active dislocations in [begin, end) from
+        // directions and hands each to claim(mover, target) in scan order.
+        template <typename Claim>
+        void propose(std::size_t begin, std::size_t end, Directions<Stencil::size>& directions, Claim claim){
+            this->for_each_site(begin, end, [&](std::size_t row, unsigned int j, bool face){
+                std::size_t i = row * this->width + j;
+                if (this->active[i] && this->now[i] == Dislocation){
+
+                    count_event(MoveProposed);
+                    unsigned int dir = directions.get(this->steps, row, j);
+                    claim(i, face ? this->neighbour(i, dir) : i + this->offset[row % Stencil::variants][dir]);
+                }
+            });
+        }
+        void propose(std::size_t begin, std::size_t end){
+            this->propose(begin, end, this->directions, [this](std::size_t i, std::size_t target){
+                this->claim(i, target, this->moved[0]);
+            });
+        }
+        // Replays the moves of the step on now, which then holds the new
+        // state as well and can stand in as next for the following step.
+        void replay(std::vector<std::size_t>& moves){
+            for (std::size_t k = 0; k < moves.size(); k += 2){
+                this->now[moves[k]] = Atom;
+                this->now[moves[k + 1]] = Dislocation;
+            }
+            moves.clear();
+        }
+        // The next states are complete: they become the current ones. Only
+        // the sites that changed are touched, so a step costs nothing for
+        // the frozen and empty parts of the lattice beyond the sweep itself.
+        void commit(){
+            for (std::vector<std::size_t>& moves : this->moved){
+                this->replay(moves);
+            }
+            std::swap(this->now, this->next);
+        }
+        // The first three phases fused into one sweep over the bands of
+        // [lo, hi): each band is deactivated and then proposes its moves
+        // while it is still in cache. Returns whether an active dislocation
+        // is left.
+        template <typename Claim>
+        bool sweep(std::size_t lo, std::size_t hi, Directions<Stencil::size>& directions, Claim claim){
+            bool running = false;
+            for (std::size_t begin = lo; begin < hi; begin += this->band){
+                std::size_t end = std::min(hi, begin + this->band);
+                bool active = this->deactivate(begin, end);
+                running = running || active;
+                this->propose(begin, end, directions, claim);
+            }
+            return running;
+        }
+        bool is_border(std::size_t index){
+            unsigned int j = index % this->width;
+            return j == 0 || j == this->width - 1
+                   || this->is_border_row(index / this->width);
+        }
+    public:
+        Crystal(const bool* scheme, Extent extent, RunKey key = RunKey{random_seed(), 0})
+            : directions(key, extent[Dim - 1]){
+            if (Stencil::variants > 1 && Boundary::wraps && extent[0] % 2 != 0){
+                throw std::invalid_argument("a periodic lattice with alternating rows needs an even number of them");
+            }
+            this->extent = extent;
+            this->width = extent[Dim - 1];
+            this->size = 1;
+            for (int a = Dim - 1; a >= 0; a--){
+                this->stride[a] = this->size;
+                this->size *= extent[a];
+            }
+            for (unsigned int v = 0; v < Stencil::variants; v++){
+                this->offset[v] = stencil_offsets<Stencil, Dim>(extent, v);
+            }
+            // Furthest any move reaches in the buffer. On a periodic lattice
+            // a move may wrap along every axis but the slowest, whose wrap
+            // is the seam that step() handles. No move reaches past the buffer.
+            this->reach = 0;
+            for (unsigned int v = 0; v < Stencil::variants; v++){
+                for (unsigned int d = 0; d < Stencil::size; d++){
+                    std::size_t distance = 0;
+                    for (unsigned int a = 0; a < Dim; a++){
+                        std::size_t span = Boundary::wraps && a > 0 ? std::max(1u, this->extent[a] - 1) : 1;
+                        distance += (Stencil::moves[v][d][a] != 0) * span * this->stride[a];
+                    }
+                    this->reach = std::max(this->reach, distance);
+                }
+            }
+            this->reach = std::min(this->reach, this->size);
+            std::size_t reach = std::max<std::size_t>(this->reach, 4096);
+            this->band = (Dim == 1) ? reach : (reach + this->width - 1) / this->width * this->width;
+
+            this->states[0].resize(this->size);
+            this->states[1].resize(this->size);
+            this->active.resize(this->size);
+            this->now = reinterpret_cast<State*>(this->states[0].data());
+            this->next = reinterpret_cast<State*>(this->states[1].data());
+            this->moved.resize(1);
+            this->reset(SchemeView(scheme, this->size), key);
+        }
+        Crystal(const bool* scheme, unsigned int side, RunKey key = RunKey{random_seed(), 0})
+            : Crystal(scheme, cube(side), key){}
+        Crystal(const Crystal&) = delete;
+        Crystal& operator=(const Crystal&) = delete;
+        static Extent cube(unsigned int side){
+            Extent extent;
+            extent.fill(side);
+            return extent;
+        }
+        void display(){
+            static_assert(Dim <= 2, "only chains and planes can be displayed");
+            std::size_t rows = this->size / this->width;
+            for (unsigned int j = 0; j < 2 * this->width + 1; j++){
+                std::cout << "--";
+            }
+            std::cout << "\n";
+            for (std::size_t i = 0; i < rows; i++){
+                for (unsigned int j = 0; j < this->width; j++){
+                    std::cout << " | " << (this->now[i * this->width + j] == Dislocation ? "■" : " ");
+                }
+                std::cout << " |\n";
+                for (unsigned int j = 0; j < 2 * this->width + 1; j++){
+                    std::cout << "--";
+                }
+                std::cout << "\n";
+            }
+        }
+        // Starts a new run from scheme with the draws of key, in the planes
+        // already allocated, so that one engine can relax a whole sweep.
+        void reset(SchemeView scheme, RunKey key){
+            if (scheme.size != this->size){
+                throw std::invalid_argument("scheme does not fit the crystal");
+            }
+            this->directions = Directions<Stencil::size>(key, this->width);
+            this->running = true;
+            this->steps = 0;
+            for (std::vector<std::size_t>& moves : this->moved){
+                moves.clear();
+            }
+            for (std::size_t i = 0; i < this->size; i++){
+                this->now[i] = (scheme[i]) ? Dislocation : Atom;
+                this->next[i] = this->now[i];
+                this->active[i] = true;
+            }
+            for (std::size_t i = 0; i < this->size && Boundary::border; i++){
+                if (this->is_border(i)){
+                    this->active[i] = false;
+                }
+            }
+        }
+        bool is_running(){
+            return this->running;
+        }
+        bool is_dislocation(std::size_t index){
+            return this->now[index] == Dislocation;
+        }
+        void check_activity(){
+            PhaseTimer timer(ActivityCheck);
+            this->running = false;
+            for (std::size_t i = 0; i < this->size; i++){
+                if (this->active[i] && this->now[i] == Dislocation){
+                    this->running = true;
+                    break;
+                }
+            }
+        }
+        void update_activity(){
+            PhaseTimer timer(ActivityUpdate);
+            this->deactivate(0, this->size);
+        }
+        void calculate_state(){
+            PhaseTimer timer(StateCalculation);
+            this->propose(0, this->size);
+            this->steps++;
+        }
+        void update_state(){
+            PhaseTimer timer(StateUpdate);
+            this->commit();
+        }
+        // One synchronous step of the whole crystal, the four phases above
+        // fused into one sweep.
+        void step(){
+            PhaseTimer timer(FusedStep);
+            this->running = this->sweep(0, this->size, this->directions,
+                                        [this](std::size_t i, std::size_t target){
+                                            this->claim(i, target, this->moved[0]);
+                                        });
+            this->commit();
+            this->steps++;
+        }
+        // The same step split into one strip of whole rows per worker of
+        // pool. Only a target within reach of a strip edge can be claimed
+        // from both sides, so such moves are left in deferred, and each
+        // edge settles its moves in scan order once every strip has been
+        // swept. Every contest is decided as in step(), so the result is
+        // the same for any number of workers. A periodic lattice has one
+        // more edge, the seam between the last strip and the first.
+        void step(ThreadPool& pool){
+            std::size_t units = this->size / this->reach;
+            unsigned int strips = std::min<std::size_t>(pool.size(), units / 4);
+            if (strips < 2){
+                this->step();
+                return;
+            }
+            PhaseTimer timer(FusedStep);
+            std::vector<std::size_t> bound(strips + 1);
+            for (unsigned int s = 0; s < strips; s++){
+                bound[s] = units * s / strips * this->reach;
+            }
+            bound[strips] = this->size;
+            this->deferred.resize(2 * strips);
+            this->moved.resize(std::max<std::size_t>(this->moved.size(), strips));
+            std::vector<unsigned char> active(strips, 0);
+            std::size_t reach = this->reach;
+
+            pool.run([&](unsigned int w){
+                if (w >= strips){
+                    return;
+                }
+                std::size_t lo = bound[w];
+                std::size_t hi = bound[w + 1];
+                bool first = w == 0 && !Boundary::wraps;
+                bool last = w + 1 == strips && !Boundary::wraps;
+                std::vector<std::size_t>& above = this->deferred[2 * w];
+                std::vector<std::size_t>& below = this->deferred[2 * w + 1];
+                std::vector<std::size_t>& moved = this->moved[w];
+                above.clear();
+                below.clear();
+                Directions<Stencil::size> directions = this->directions;
+                active[w] = this->sweep(lo, hi, directions,
+                                        [&](std::size_t i, std::size_t target){
+                                            // Only the first and last strips of a
+                                            // periodic lattice reach across the seam.
+                                            bool seam = target + reach < lo || target >= hi + reach;
+                                            if (seam ? w == 0 : !first && target < lo + reach){
+                                                above.push_back(i);
+                                                above.push_back(target);
+                                            }
+                                            else if (seam || (!last && target >= hi - reach)){
+                                                below.push_back(i);
+                                                below.push_back(target);
+                                            }
+                                            else{
+                                                this->claim(i, target, moved);
+                                            }
+                                        });
+            });
+            auto settle = [this](std::vector<std::size_t>& moves, std::vector<std::size_t>& moved){
+                for (std::size_t k = 0; k < moves.size(); k += 2){
+                    this->claim(moves[k], moves[k + 1], moved);
+                }
+            };
+            // Worker w takes the edge between strips w and w + 1, whose
+            // moves from the upper strip come first in scan order, and the
+            // last worker the seam, where the first strip's moves do. Then
+            // it replays the moves it has granted, which touch no site of
+            // another worker's.
+            pool.run([&](unsigned int w){
+                if (w >= strips){
+                    return;
+                }
+                std::vector<std::size_t>& moved = this->moved[w];
+                if (w + 1 < strips){
+                    settle(this->deferred[2 * w + 1], moved);
+                    settle(this->deferred[2 * w + 2], moved);
+                }
+                else if (Boundary::wraps){
+                    settle(this->deferred[0], moved);
+                    settle(this->deferred[2 * w + 1], moved);
+                }
+                this->replay(moved);
+            });
+
+            this->commit();
+            this->running = std::find(active.begin(), active.end(), 1) != active.end();
+            this->steps++;
+        }
+};
+
+// Engines with other boundaries and lattices, for the Engine parameter of
+// the sweeps.
+template <unsigned int Dim>
+using PeriodicCrystal = Crystal<Dim, Periodic>;
+
+template <unsigned int Dim>
+using ReflectingCrystal = Crystal<Dim, Reflecting>;
+
+template <unsigned int Dim>
+using MooreCrystal = Crystal<Dim, Absorbing, Moore>;
+
+template <unsigned int Dim>
+using HexCrystal = Crystal<Dim, Absorbing, Hexagonal>;
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef EXACT_H
+#define EXACT_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "crystal.h"
+#include "experiment.h"
+#include "parallel.h"
+
+// Exact expected relaxation time of small crystals, without sampling.
+//
+// Once update_activity has run, a dislocation is free to move exactly when
+// it is off the border and has no dislocation next to it, and moves never
+// create or merge dislocations. The set of occupied sites is therefore a
+// Markov chain on the K-subsets of the lattice, and the expected number of
+// steps h(x) that cycle() counts from placement x solves
+//
+//     h(x) = 0                            if nothing in x can move,
+//     h(x) = 1 + sum_y P(x -> y) h(y)    otherwise,
+//
+// where P enumerates every combination of directions of the free
+// dislocations, resolved exactly as Crystal does. Placements are
+// bitmasks, so the lattice may have at most 64 sites.
+template <unsigned int Dim>
+class ExactSolver{
+    public:
+        typedef Neighbourhood<Dim> Stencil;
+    private:
+        unsigned int N;
+        unsigned int K;
+        std::uint64_t interior;
+        std::vector<std::uint64_t> neighbours;
+        std::array<std::ptrdiff_t, Stencil::size> offset;
+        // choose[n][k] = C(n, k) for the colex ranking of placements.
+        std::vector<std::vector<unsigned long long>> choose;
+
+        unsigned long long rank(std::uint64_t mask){
+            unsigned long long r = 0;
+            for (unsigned int i = 1; mask; i++){
+                unsigned int p = __builtin_ctzll(mask);
+                r += this->choose[p][i];
+                mask &= mask - 1;
+            }
+            return r;
+        }
+        static std::uint64_t next_combination(std::uint64_t x){
+            std::uint64_t low = x & (~x + 1);
+            std::uint64_t ripple = x + low;
+            return ripple | (((x ^ ripple) >> 2) / low);
+        }
+        std::uint64_t free_sites(std::uint64_t x){
+            std::uint64_t free = 0;
+            std::uint64_t candidates = x & this->interior;
+            while (candidates){
+                unsigned int s = __builtin_ctzll(candidates);
+                if (!(this->neighbours[s] & x)){
+                    free |= std::uint64_t(1) << s;
+                }
+                candidates &= candidates - 1;
+            }
+            return free;
+        }
+        // One sweep h_new(x) = 1 + E[h_old(y)] over placements [begin, end)
+        // of the colex order, starting from placement x; returns the
+        // largest change.
+        double sweep(std::uint64_t x, unsigned long long begin, unsigned long long end,
+                     const std::vector<double>& h_old, std::vector<double>& h_new){
+            double change = 0;
+            std::array<unsigned int, 64> movers;
+            for (unsigned long long r = begin; r < end; r++, x = next_combination(x)){
+                std::uint64_t free = this->free_sites(x);
+                if (!free){
+                    h_new[r] = 0;
+                    continue;
+                }
+                unsigned int a = 0;
+                for (std::uint64_t f = free; f; f &= f - 1){
+                    movers[a++] = __builtin_ctzll(f);
+                }
+                unsigned long long outcomes = 1;
+                for (unsigned int i = 0; i < a; i++){
+                    outcomes *= Stencil::size;
+                }
+                double sum = 0;
+                for (unsigned long long c = 0; c < outcomes; c++){
+                    std::uint64_t claimed = 0;
+                    std::uint64_t moved = 0;
+                    unsigned long long digits = c;
+                    for (unsigned int i = 0; i < a; i++){
+                        unsigned int d = digits % Stencil::size;
+                        digits /= Stencil::size;
+                        std::uint64_t target = std::uint64_t(1) << (movers[i] + this->offset[d]);
+                        if (!(claimed & target)){
+                            claimed |= target;
+                            moved |= std::uint64_t(1) << movers[i];
+                        }
+                    }
+                    sum += h_old[this->rank((x & ~moved) | claimed)];
+                }
+                double value = 1 + sum / outcomes;
+                change = std::max(change, std::fabs(value - h_old[r]));
+                h_new[r] = value;
+            }
+            return change;
+        }
+    public:
+        ExactSolver(unsigned int size, unsigned int disloc_number){
+            std::array<unsigned int, Dim> extent = Crystal<Dim>::cube(size);
+            this->N = 1;
+            for (unsigned int d = 0; d < Dim; d++){
+                this->N *= size;
+            }
+            if (this->N > 64){
+                throw std::invalid_argument("exact solver needs at most 64 sites");
+            }
+            this->K = disloc_number;
+            this->offset = Stencil::offsets(extent);
+            this->choose.assign(this->N + 1, std::vector<unsigned long long>(this->K + 2, 0));
+            for (unsigned int n = 0; n <= this->N; n++){
+                for (unsigned int k = 0; k <= this->K + 1; k++){
+                    this->choose[n][k] = binomial(n, k);
+                }
+            }
+
+            // Neighbour masks of the interior sites, from the coordinates.
+            this->interior = 0;
+            this->neighbours.assign(this->N, 0);
+            for (unsigned int s = 0; s < this->N; s++){
+                bool border = false;
+                unsigned int rest = s;
+                for (unsigned int d = 0; d < Dim; d++){
+                    unsigned int coord = rest % size;
+                    rest /= size;
+                    border = border || coord == 0 || coord == size - 1;
+                }
+                if (border){
+                    continue;
+                }
+                this->interior |= std::uint64_t(1) << s;
+                for (unsigned int d = 0; d < Stencil::size; d++){
+                    this->neighbours[s] |= std::uint64_t(1) << (s + this->offset[d]);
+                }
+            }
+        }
+        // Mean of h over all C(N, K) placements. Iterates the equations
+        // above until no value changes by more than tolerance; the sweeps
+        // are split over pool and never read values of the same sweep, so
+        // the result does not depend on the number of workers.
+        long double solve(ThreadPool& pool, double tolerance = 1e-12){
+            unsigned long long states = binomial(this->N, this->K);
+            if (this->K == 0 || this->K > this->N){
+                return 0;
+            }
+            unsigned int threads = pool.size();
+            std::vector<std::uint64_t> starts(threads);
+            std::vector<unsigned long long> begins(threads + 1);
+            std::uint64_t x = (this->K == 64) ? ~std::uint64_t(0) : (std::uint64_t(1) << this->K) - 1;
+            for (unsigned int t = 0; t <= threads; t++){
+                begins[t] = states * t / threads;
+            }
+            for (unsigned long long r = 0, t = 0; t < threads; r++){
+                while (t < threads && begins[t] == r){
+                    starts[t++] = x;
+                }
+                x = next_combination(x);
+            }
+
+            std::vector<double> h(states, 0), h_next(states, 0);
+            std::vector<double> change(threads);
+            double largest;
+            do {
+                pool.run([&](unsigned int worker){
+                    change[worker] = this->sweep(starts[worker], begins[worker], begins[worker + 1],
+                                                 h, h_next);
+                });
+                h.swap(h_next);
+                largest = *std::max_element(change.begin(), change.end());
+            } while (largest > tolerance);
+
+            long double total = 0;
+            for (double value : h){
+                total += value;
+            }
+            return total / states;
+        }
+};
+
+// Exact mean relaxation time of a single dislocation, for lattices far
+// beyond the 64 sites of ExactSolver. Alone, the dislocation is never
+// blocked and walks until it reaches the border, so h is the expected exit
+// time of a simple random walk, the solution of the discrete Poisson
+// problem
+//
+//     h(x) = 0                                        on the border,
+//     2 Dim h(x) - sum_{y next to x} h(y) = 2 Dim     inside.
+//
+// h does not change under the reflections and axis permutations of the
+// cube, so only the sites with folded coordinates 1 <= f_1 <= ... <= f_Dim,
+// f = min(c, size - 1 - c), are kept. Weighting the equation of each kept
+// site by the number of sites in its orbit turns the reduced system into a
+// symmetric positive definite one with integer entries, which conjugate
+// gradients solve in O(size) iterations.
+template <unsigned int Dim>
+class FirstPassageSolver{
+    private:
+        static constexpr std::size_t block = 4096;
+
+        unsigned int size;
+        std::size_t N;
+        // The reduced system in compressed rows: row i is diagonal[i] on the
+        // diagonal and values[k] in column columns[k] for k in
+        // [first[i], first[i + 1]). weight[i] is the size of the orbit.
+        std::vector<double> diagonal;
+        std::vector<std::size_t> first;
+        std::vector<std::uint32_t> columns;
+        std::vector<double> values;
+        std::vector<double> weight;
+        std::vector<double> partial;
+
+        // Sums f(begin, end) over fixed blocks of rows, split over pool and
+        // added in order, so the sum does not depend on the number of workers.
+        template <typename F>
+        double blockwise(ThreadPool& pool, F f){
+            std::size_t rows = this->diagonal.size();
+            std::size_t blocks = this->partial.size();
+            unsigned int threads = pool.size();
+            pool.run([&](unsigned int worker){
+                for (std::size_t b = blocks * worker / threads; b < blocks * (worker + 1) / threads; b++){
+                    this->partial[b] = f(b * block, std::min(rows, (b + 1) * block));
+                }
+            });
+            double sum = 0;
+            for (double value : this->partial){
+                sum += value;
+            }
+            return sum;
+        }
+    public:
+        FirstPassageSolver(unsigned int size){
+            this->size = size;
+            this->N = 1;
+            for (unsigned int a = 0; a < Dim; a++){
+                this->N *= size;
+            }
+            // Folded coordinates run over [0, top]; 0 is the border.
+            unsigned int top = size > 0 ? (size - 1) / 2 : 0;
+            std::size_t cells = 1;
+            for (unsigned int a = 0; a < Dim; a++){
+                cells *= top + 1;
+            }
+            const std::uint32_t none = ~std::uint32_t(0);
+            std::vector<std::uint32_t> index(cells, none);
+            std::vector<std::array<unsigned int, Dim>> kept;
+            for (std::size_t c = 0; c < cells; c++){
+                std::array<unsigned int, Dim> f;
+                std::size_t rest = c;
+                for (int a = Dim - 1; a >= 0; a--){
+                    f[a] = rest % (top + 1);
+                    rest /= top + 1;
+                }
+                if (f[0] >= 1 && std::is_sorted(f.begin(), f.end())){
+                    index[c] = kept.size();
+                    kept.push_back(f);
+                }
+            }
+            auto cell = [top](const std::array<unsigned int, Dim>& f){
+                std::size_t c = 0;
+                for (unsigned int a = 0; a < Dim; a++){
+                    c = c * (top + 1) + f[a];
+                }
+                return c;
+            };
+
+            this->first.push_back(0);
+            for (const std::array<unsigned int, Dim>& f : kept){
+                // Sites per orbit: the mirror images of each coordinate,
+                // times the distinct orders of the coordinates.
+                double orbit = 1;
+                unsigned int run = 1;
+                for (unsigned int a = 0; a < Dim; a++){
+                    orbit *= (2 * f[a] + 1 == size) ? 1 : 2;
+                    run = (a > 0 && f[a] == f[a - 1]) ? run + 1 : 1;
+                    orbit = orbit * (a + 1) / run;
+                }
+                std::size_t self = this->diagonal.size();
+                double diagonal = 2 * Dim * orbit;
+                std::size_t begin = this->columns.size();
+                for (unsigned int a = 0; a < Dim; a++){
+                    for (int sign : {-1, 1}){
+                        long c = long(f[a]) + sign;
+                        std::array<unsigned int, Dim> g = f;
+                        g[a] = std::min<long>(c, long(size) - 1 - c);
+                        if (g[a] == 0){
+                            continue;
+                        }
+                        std::sort(g.begin(), g.end());
+                        std::uint32_t column = index[cell(g)];
+                        if (column == self){
+                            diagonal -= orbit;
+                            continue;
+                        }
+                        std::size_t k = begin;
+                        while (k < this->columns.size() && this->columns[k] != column){
+                            k++;
+                        }
+                        if (k == this->columns.size()){
+                            this->columns.push_back(column);
+                            this->values.push_back(0);
+                        }
+                        this->values[k] -= orbit;
+                    }
+                }
+                this->diagonal.push_back(diagonal);
+                this->weight.push_back(orbit);
+                this->first.push_back(this->columns.size());
+            }
+            this->partial.assign((kept.size() + block - 1) / block, 0);
+        }
+        // Number of unknowns left after the symmetry reduction.
+        std::size_t unknowns(){
+            return this->diagonal.size();
+        }
+        // Mean of h over all sites, the border included. Iterates until the
+        // weighted residual falls below tolerance times the right-hand side.
+        long double solve(ThreadPool& pool, double tolerance = 1e-13){
+            std::size_t rows = this->diagonal.size();
+            if (rows == 0){
+                return 0;
+            }
+            std::vector<double> h(rows, 0), r(rows), p(rows), q(rows);
+            double rr = this->blockwise(pool, [&](std::size_t begin, std::size_t end){
+                double sum = 0;
+                for (std::size_t i = begin; i < end; i++){
+                    r[i] = p[i] = 2 * Dim * this->weight[i];
+                    sum += r[i] * r[i];
+                }
+                return sum;
+            });
+            double target = tolerance * tolerance * rr;
+            for (std::size_t iteration = 0; rr > target && iteration < 10 * rows + 100; iteration++){
+                double pq = this->blockwise(pool, [&](std::size_t begin, std::size_t end){
+                    double sum = 0;
+                    for (std::size_t i = begin; i < end; i++){
+                        double value = this->diagonal[i] * p[i];
+                        for (std::size_t k = this->first[i]; k < this->first[i + 1]; k++){
+                            value += this->values[k] * p[this->columns[k]];
+                        }
+                        q[i] = value;
+                        sum += p[i] * value;
+                    }
+                    return sum;
+                });
+                double alpha = rr / pq;
+                double next = this->blockwise(pool, [&](std::size_t begin, std::size_t end){
+                    double sum = 0;
+                    for (std::size_t i = begin; i < end; i++){
+                        h[i] += alpha * p[i];
+                        r[i] -= alpha * q[i];
+                        sum += r[i] * r[i];
+                    }
+                    return sum;
+                });
+                double beta = next / rr;
+                rr = next;
+                this->blockwise(pool, [&](std::size_t begin, std::size_t end){
+                    for (std::size_t i = begin; i < end; i++){
+                        p[i] = r[i] + beta * p[i];
+                    }
+                    return 0.0;
+                });
+            }
+
+            long double total = 0;
+            for (std::size_t i = 0; i < rows; i++){
+                total += (long double)(this->weight[i]) * h[i];
+            }
+            return total / this->N;
+        }
+};
+
+// Exact counterpart of test_run for crystals of at most 64 sites.
+template <unsigned int Dim>
+long double exact_run(unsigned int disloc_number, unsigned int size, ThreadPool& pool = default_pool()){
+    ExactSolver<Dim> solver(size, disloc_number);
+    return solver.solve(pool);
+}
+
+// Exact counterpart of test_run with a single dislocation, for any size.
+template <unsigned int Dim>
+long double first_passage_run(unsigned int size, ThreadPool& pool = default_pool()){
+    FirstPassageSolver<Dim> solver(size);
+    return solver.solve(pool);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef EXPERIMENT_H
+#define EXPERIMENT_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "crystal.h"
+#include "instrument.h"
+#include "parallel.h"
+#include "placement.h"
+#include "random.h"
+
+const int max_iterations = 1000000;
+
+// The slot of the calling thread for an Engine, emptied whenever the side
+// differs from that of the engine it holds.
+template <unsigned int Dim, template <unsigned int> class Engine>
+std::unique_ptr<Engine<Dim>>& engine_slot(unsigned int size){
+    thread_local std::unique_ptr<Engine<Dim>> engine;
+    thread_local unsigned int side = 0;
+    if (side != size){
+        engine.reset();
+        side = size;
+    }
+    return engine;
+}
+
+// The engine of the calling thread for crystals of side size, set up to
+// relax scheme with the draws of key. It is built on first use and reset
+// in place afterwards, so a sweep allocates once per thread and size
+// instead of once per run. The reference stays valid until the next call
+// on the same thread.
+template <unsigned int Dim, template <unsigned int> class Engine>
+Engine<Dim>& pooled_engine(SchemeView scheme, unsigned int size, RunKey key){
+    std::unique_ptr<Engine<Dim>>& engine = engine_slot<Dim, Engine>(size);
+    if (engine){
+        engine->reset(scheme, key);
+    }
+    else{
+        engine = std::make_unique<Engine<Dim>>(scheme.sites, size, key);
+    }
+    return *engine;
+}
+
+// The same for engines that load their runs themselves, like
+// ReplicaCrystal, which are built from the side alone.
+template <unsigned int Dim, template <unsigned int> class Engine>
+Engine<Dim>& pooled_engine(unsigned int size){
+    std::unique_ptr<Engine<Dim>>& engine = engine_slot<Dim, Engine>(size);
+    if (!engine){
+        engine = std::make_unique<Engine<Dim>>(size);
+    }
+    return *engine;
+}
+
+// Relaxes the crystal built from scheme and returns the number of steps
+// in which at least one dislocation was still free to move. Engine is any
+// class with the Crystal interface, e.g. BitCrystal.
+template <unsigned int Dim, template <unsigned int> class Engine = Crystal>
+int cycle(const bool* scheme, unsigned int size, RunKey key){
+    unsigned int N = 1;
+    for (unsigned int d = 0; d < Dim; d++){
+        N *= size;
+    }
+    int iter = 0;
+    Engine<Dim>& crystal = pooled_engine<Dim, Engine>(SchemeView(scheme, N), size, key);
+    while (crystal.is_running()){
+
+        crystal.step();
+        iter++;
+        if (iter > max_iterations){
+            break;
+        }
+    }
+    count_event(RunStep, iter - 1);
+    count_event(RunEnd);
+    return iter - 1;
+}
+
+// Relaxes runs [first, last) of a test_run sweep point one crystal at a
+// time and returns their total relaxation time. Engines that relax many
+// runs together, like ReplicaCrystal, specialise it.
+template <unsigned int Dim, template <unsigned int> class Engine>
+struct RunRange{
+    static long long unsigned int sum(unsigned int disloc_number, unsigned int size, std::uint64_t key,
+                                      unsigned long long first, unsigned long long last){
+        unsigned int N = 1;
+        for (unsigned int d = 0; d < Dim; d++){
+            N *= size;
+        }
+        long long unsigned int moves = 0;
+        bool* scheme = new bool[N];
+        Placements placements(N, disloc_number, first);
+        for (unsigned long long run = first; run < last; run++){
+            placements.write(scheme);
+            moves += cycle<Dim, Engine>(scheme, size, RunKey{key, run});
+            placements.next();
+        }
+        delete[] scheme;
+        return moves;
+    }
+};
+
+// Total relaxation time of runs [begin, end) of a test_run sweep point
+// with point seed key. Run i relaxes placement i mod C(N, K) with
+// directions from RunKey{key, i}.
+template <unsigned int Dim, template <unsigned int> class Engine = Crystal>
+long long unsigned int test_sum(unsigned int disloc_number, unsigned int size, std::uint64_t key,
+                                unsigned long long begin, unsigned long long end,
+                                ThreadPool& pool = default_pool()){
+    unsigned long long total = end - begin;
+    unsigned int threads = pool.size();
+    std::vector<long long unsigned int> moves(threads, 0);
+
+    pool.run([&](unsigned int worker){
+        unsigned long long first = begin + total * worker / threads;
+        unsigned long long last = begin + total * (worker + 1) / threads;
+        if (first == last){
+            return;
+        }
+        moves[worker] = RunRange<Dim, Engine>::sum(disloc_number, size, key, first, last);
+    });
+
+    long long unsigned int move_number = 0;
+    for (long long unsigned int m : moves){
+        move_number += m;
+    }
+    return move_number;
+}
+
+// Mean relaxation time over every placement of disloc_number dislocations
+// on a crystal of side size, each placement relaxed repeat_number times.
+//
+// The repeat_number * C(N, K) runs are cut into one contiguous range per
+// worker of pool. Run number i draws from RunKey{point seed, i}, and the
+// sums are integers, so the result depends only on the seed: not on the
+// number of workers and not on thread timing.
+template <unsigned int Dim, template <unsigned int> class Engine = Crystal>
+long double test_run(unsigned int disloc_number, unsigned int size, int repeat_number,
+                     std::uint64_t seed = random_seed(), ThreadPool& pool = default_pool()){
+    unsigned int N = 1;
+    for (unsigned int d = 0; d < Dim; d++){
+        N *= size;
+    }
+    unsigned long long total = binomial(N, disloc_number) * repeat_number;
+    std::uint64_t key = point_seed(seed, Dim, size, disloc_number);
+    long long unsigned int move_number = test_sum<Dim, Engine>(disloc_number, size, key, 0, total, pool);
+    long long unsigned int cycle_number = total;
+    return (long double)(move_number) / cycle_number;
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <cstdint>
+#include <ostream>
+
+#ifdef CRYSTAL_INSTRUMENT
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+// Optional counters around the step phases of the engines. Built with
+// -DCRYSTAL_INSTRUMENT, every phase records its time and, where the kernel
+// allows perf_event_open, its cache and branch misses; the engines also
+// count proposed, blocked and deactivated moves and cycle() the steps of
+// every run. Crystal's step() does all four phases in one sweep, so its
+// whole step is charged to a phase of its own, FusedStep. Without the
+// flag PhaseTimer is empty and count_event does nothing, so the hooks
+// compile away.
+
+#ifdef CRYSTAL_INSTRUMENT
+constexpr bool instrumented = true;
+#else
+constexpr bool instrumented = false;
+#endif
+
+enum Phase {ActivityUpdate, ActivityCheck, StateCalculation, StateUpdate, FusedStep, phase_count};
+enum Event {MoveProposed, MoveBlocked, Deactivation, RunStep, RunEnd, event_count};
+
+#ifdef CRYSTAL_INSTRUMENT
+struct Tallies{
+    std::uint64_t nanoseconds[phase_count] = {};
+    std::uint64_t calls[phase_count] = {};
+    std::uint64_t cache_misses[phase_count] = {};
+    std::uint64_t branch_misses[phase_count] = {};
+    std::uint64_t events[event_count] = {};
+
+    void add(const Tallies& other){
+        for (int p = 0; p < phase_count; p++){
+            this->nanoseconds[p] += other.nanoseconds[p];
+            this->calls[p] += other.calls[p];
+            this->cache_misses[p] += other.cache_misses[p];
+            this->branch_misses[p] += other.branch_misses[p];
+        }
+        for (int e = 0; e < event_count; e++){
+            this->events[e] += other.events[e];
+        }
+    }
+};
+
+// Cache and branch misses of the calling thread in user space, read as one
+// perf event group. available() is false where perf_event_open is missing
+// or forbidden (e.g. perf_event_paranoid or a container), and read() then
+// returns zeros.
+class HardwareCounters{
+    private:
+        int leader;
+        int member;
+    public:
+        HardwareCounters(){
+            this->leader = -1;
+            this->member = -1;
+#ifdef __linux__
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            this->leader = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (this->leader < 0){
+                return;
+            }
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            this->member = syscall(__NR_perf_event_open, &attr, 0, -1, this->leader, 0);
+            if (this->member < 0){
+                close(this->leader);
+                this->leader = -1;
+            }
+#endif
+        }
+        HardwareCounters(const HardwareCounters&) = delete;
+        HardwareCounters& operator=(const HardwareCounters&) = delete;
+        ~HardwareCounters(){
+#ifdef __linux__
+            if (this->leader >= 0){
+                close(this->member);
+                close(this->leader);
+            }
+#endif
+        }
+        bool available(){
+            return this->leader >= 0;
+        }
+        void read(std::uint64_t out[2]){
+            out[0] = 0;
+            out[1] = 0;
+#ifdef __linux__
+            std::uint64_t group[3];
+            if (this->leader >= 0 && ::read(this->leader, group, sizeof(group)) == sizeof(group)){
+                out[0] = group[1];
+                out[1] = group[2];
+            }
+#endif
+        }
+};
+
+// All tallies of the process: those of live threads are summed on demand,
+// those of finished threads were folded into retired when they exited.
+// It is never destroyed, since the workers of a static pool exit after
+// the other statics are gone.
+struct InstrumentRegistry{
+    std::mutex lock;
+    Tallies retired;
+    std::vector<Tallies*> live;
+    bool hardware = false;
+};
+
+inline InstrumentRegistry& instrument_registry(){
+    static InstrumentRegistry* registry = new InstrumentRegistry();
+    return *registry;
+}
+
+class ThreadTallies{
+    public:
+        Tallies tallies;
+        HardwareCounters hardware;
+        ThreadTallies(){
+            InstrumentRegistry& registry = instrument_registry();
+            std::lock_guard<std::mutex> guard(registry.lock);
+            registry.live.push_back(&this->tallies);
+            registry.hardware = registry.hardware || this->hardware.available();
+        }
+        ~ThreadTallies(){
+            InstrumentRegistry& registry = instrument_registry();
+            std::lock_guard<std::mutex> guard(registry.lock);
+            registry.retired.add(this->tallies);
+            registry.live.erase(std::find(registry.live.begin(), registry.live.end(), &this->tallies));
+        }
+};
+
+inline ThreadTallies& thread_tallies(){
+    thread_local ThreadTallies tallies;
+    return tallies;
+}
+#endif
+
+// Charges the lifetime of the object to phase.
+class PhaseTimer{
+#ifdef CRYSTAL_INSTRUMENT
+    private:
+        Phase phase;
+        std::chrono::steady_clock::time_point start;
+        std::uint64_t misses[2];
+    public:
+        explicit PhaseTimer(Phase phase){
+            this->phase = phase;
+            thread_tallies().hardware.read(this->misses);
+            this->start = std::chrono::steady_clock::now();
+        }
+        ~PhaseTimer(){
+            auto end = std::chrono::steady_clock::now();
+            ThreadTallies& t = thread_tallies();
+            std::uint64_t misses[2];
+            t.hardware.read(misses);
+            t.tallies.nanoseconds[this->phase] +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - this->start).count();
+            t.tallies.calls[this->phase]++;
+            t.tallies.cache_misses[this->phase] += misses[0] - this->misses[0];
+            t.tallies.branch_misses[this->phase] += misses[1] - this->misses[1];
+        }
+#else
+    public:
+        explicit PhaseTimer(Phase){}
+#endif
+};
+
+inline void count_event(Event event, std::uint64_t n = 1){
+#ifdef CRYSTAL_INSTRUMENT
+    thread_tallies().tallies.events[event] += n;
+#else
+    (void)event;
+    (void)n;
+#endif
+}
+
+// Prints the totals of all threads. Call it while no engine is stepping,
+// e.g. at the end of a sweep; without CRYSTAL_INSTRUMENT it prints nothing.
+inline void instrument_report(std::ostream& out){
+#ifdef CRYSTAL_INSTRUMENT
+    InstrumentRegistry& registry = instrument_registry();
+    Tallies total;
+    bool hardware;
+    {
+        std::lock_guard<std::mutex> guard(registry.lock);
+        total.add(registry.retired);
+        for (Tallies* t : registry.live){
+            total.add(*t);
+        }
+        hardware = registry.hardware;
+    }
+    const char* names[phase_count] = {"update_activity", "check_activity", "calculate_state", "update_state",
+                                        "step"};
+    out << std::left << std::setw(18) << "phase" << std::right << std::setw(14) << "ms"
+        << std::setw(14) << "ns/call" << std::setw(16) << "cache misses" << std::setw(16) << "branch misses" << "\n";
+    for (int p = 0; p < phase_count; p++){
+        out << std::left << std::setw(18) << names[p] << std::right << std::fixed << std::setprecision(1)
+            << std::setw(14) << total.nanoseconds[p] / 1e6
+            << std::setw(14) << (total.calls[p] ? double(total.nanoseconds[p]) / total.calls[p] : 0.0);
+        if (hardware){
+            out << std::setw(16) << total.cache_misses[p] << std::setw(16) << total.branch_misses[p];
+        }
+        else{
+            out << std::setw(16) << "n/a" << std::setw(16) << "n/a";
+        }
+        out << "\n";
+    }
+    std::uint64_t proposed = total.events[MoveProposed];
+    std::uint64_t runs = total.events[RunEnd];
+    out << std::defaultfloat << std::setprecision(6)
+        << "moves proposed " << proposed << ", blocked " << total.events[MoveBlocked]
+        << " (" << (proposed ? 100.0 * total.events[MoveBlocked] / proposed : 0.0) << "%)"
+        << ", deactivations " << total.events[Deactivation] << "\n"
+        << "runs " << runs << ", steps per run "
+        << (runs ? double(total.events[RunStep]) / runs : 0.0) << "\n";
+#else
+    (void)out;
+#endif
+}
+
+#endif
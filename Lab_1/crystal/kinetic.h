@@ -0,0 +1,294 @@
+#ifndef KINETIC_H
+#define KINETIC_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "crystal.h"
+#include "instrument.h"
+#include "memory.h"
+#include "parallel.h"
+#include "placement.h"
+#include "random.h"
+
+// Continuous-time version of the model. Every dislocation that is free to
+// move hops to a uniformly chosen neighbour after an exponential waiting
+// time of mean 1, independently of the others, so one unit of time holds
+// about one hop per dislocation, like one step of Crystal. As there, a
+// dislocation that touches another one or reaches the border freezes for
+// good, and the run ends when none is left free.
+//
+// The pending hops wait in a priority queue keyed by their time, and
+// step() carries out the earliest one, so the cost grows with the number
+// of hops rather than with lattice sweeps. A frozen dislocation keeps its
+// entry in the queue, which step() drops when it comes up. Hops draw from
+// the counter-based stream of the RunKey, one block per hop in the order
+// they are scheduled.
+template <unsigned int Dim, class Generator = DefaultGenerator>
+class KineticCrystal{
+    public:
+        typedef Neighbourhood<Dim> Stencil;
+        typedef std::array<unsigned int, Dim> Extent;
+    private:
+        enum Flag : unsigned char {Occupied = 1, Border = 2, Walker = 4};
+        typedef std::vector<unsigned char, HugePageAllocator<unsigned char>> Plane;
+
+        // A hop of the walker on site in direction heading at time.
+        struct Hop{
+            double time;
+            std::size_t site;
+            unsigned int heading;
+
+            bool operator>(const Hop& other) const{
+                return this->time > other.time;
+            }
+        };
+
+        Extent extent;
+        std::array<std::size_t, Dim> stride;
+        std::array<std::ptrdiff_t, Stencil::size> offset;
+        std::array<unsigned int, Stencil::size> axis;
+        std::array<int, Stencil::size> sign;
+        std::size_t size;
+        RunKey key;
+        std::uint64_t draws;
+        std::uint64_t hops;
+        double now;
+        std::size_t walkers;
+
+        Plane flags;
+        Plane contacts;
+        // Min-heap of the pending hops, in a plain vector so that reset()
+        // can empty it without giving back its memory.
+        std::vector<Hop> queue;
+
+        bool is_border(std::size_t index){
+            for (unsigned int a = 0; a < Dim; a++){
+                unsigned int coord = index / this->stride[a] % this->extent[a];
+                if (coord == 0 || coord == this->extent[a] - 1){
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Calls f(neighbour) for every neighbour of index inside the lattice.
+        template <typename F>
+        void for_each_neighbour(std::size_t index, F f){
+            bool border = this->flags[index] & Border;
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                if (border){
+                    unsigned int a = this->axis[d];
+                    long coord = index / this->stride[a] % this->extent[a];
+                    coord += this->sign[d];
+                    if (coord < 0 || coord >= long(this->extent[a])){
+                        continue;
+                    }
+                }
+                f(index + this->offset[d]);
+            }
+        }
+        void touch_neighbours(std::size_t index, int delta){
+            this->for_each_neighbour(index, [this, delta](std::size_t neighbour){
+                this->contacts[neighbour] += delta;
+            });
+        }
+        // Draws the next hop of the walker on site.
+        void schedule(std::size_t site){
+            std::uint64_t block[2];
+            Generator::generate(this->key.seed, this->key.run, 0xFFFFFFFE - (this->draws >> 32),
+                                this->draws, block);
+            this->draws++;
+            double uniform = ((block[0] >> 11) + 1) * 0x1p-53;
+            unsigned int heading = (std::uint32_t(block[1]) * std::uint64_t(Stencil::size)) >> 32;
+            this->queue.push_back(Hop{this->now - std::log(uniform), site, heading});
+            std::push_heap(this->queue.begin(), this->queue.end(), std::greater<Hop>());
+        }
+        void freeze(std::size_t site){
+            count_event(Deactivation);
+            this->flags[site] &= ~Walker;
+            this->walkers--;
+        }
+    public:
+        KineticCrystal(const bool* scheme, Extent extent, RunKey key = RunKey{random_seed(), 0}){
+            this->extent = extent;
+            this->offset = Stencil::offsets(extent);
+            this->size = 1;
+            for (int a = Dim - 1; a >= 0; a--){
+                this->stride[a] = this->size;
+                this->size *= extent[a];
+            }
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                std::size_t step = this->offset[d] < 0 ? -this->offset[d] : this->offset[d];
+                this->axis[d] = Dim - 1;
+                for (unsigned int a = 0; a < Dim; a++){
+                    if (this->stride[a] == step){
+                        this->axis[d] = a;
+                        break;
+                    }
+                }
+                this->sign[d] = this->offset[d] < 0 ? -1 : 1;
+            }
+            this->flags.assign(this->size, 0);
+            this->contacts.assign(this->size, 0);
+            for (std::size_t i = 0; i < this->size; i++){
+                if (this->is_border(i)){
+                    this->flags[i] |= Border;
+                }
+            }
+            this->reset(SchemeView(scheme, this->size), key);
+        }
+        KineticCrystal(const bool* scheme, unsigned int side, RunKey key = RunKey{random_seed(), 0})
+            : KineticCrystal(scheme, Crystal<Dim>::cube(side), key){}
+
+        // Starts a new run from scheme with the draws of key, keeping the
+        // planes and the capacity of the queue.
+        void reset(SchemeView scheme, RunKey key){
+            if (scheme.size != this->size){
+                throw std::invalid_argument("scheme does not fit the crystal");
+            }
+            this->key = key;
+            this->draws = 0;
+            this->hops = 0;
+            this->now = 0;
+            this->walkers = 0;
+            this->queue.clear();
+            std::fill(this->contacts.begin(), this->contacts.end(), 0);
+            for (std::size_t i = 0; i < this->size; i++){
+                this->flags[i] &= Border;
+            }
+            for (std::size_t i = 0; i < this->size; i++){
+                if (scheme[i]){
+                    this->flags[i] |= Occupied;
+                    this->touch_neighbours(i, 1);
+                }
+            }
+            for (std::size_t i = 0; i < this->size; i++){
+                if ((this->flags[i] & (Occupied | Border)) != Occupied){
+                    continue;
+                }
+                if (this->contacts[i] > 0){
+                    count_event(Deactivation);
+                    continue;
+                }
+                this->flags[i] |= Walker;
+                this->walkers++;
+                this->schedule(i);
+            }
+        }
+
+        bool is_running(){
+            return this->walkers > 0;
+        }
+        bool is_dislocation(std::size_t index){
+            return this->flags[index] & Occupied;
+        }
+        std::size_t walker_number(){
+            return this->walkers;
+        }
+        // Time of the last hop, i.e. the absorption time once the run is over.
+        double time(){
+            return this->now;
+        }
+        std::uint64_t hop_number(){
+            return this->hops;
+        }
+        // Carries out the next hop and freezes whatever it brings into contact.
+        void step(){
+            while (!this->queue.empty()){
+                std::pop_heap(this->queue.begin(), this->queue.end(), std::greater<Hop>());
+                Hop hop = this->queue.back();
+                this->queue.pop_back();
+                if (!(this->flags[hop.site] & Walker)){
+                    continue;
+                }
+                count_event(MoveProposed);
+                this->now = hop.time;
+                this->hops++;
+                std::size_t target = hop.site + this->offset[hop.heading];
+                this->flags[hop.site] &= ~(Occupied | Walker);
+                this->touch_neighbours(hop.site, -1);
+                this->flags[target] |= Occupied | Walker;
+                this->touch_neighbours(target, 1);
+
+                if (this->contacts[target] > 0){
+                    this->for_each_neighbour(target, [this](std::size_t neighbour){
+                        if (this->flags[neighbour] & Walker){
+                            this->freeze(neighbour);
+                        }
+                    });
+                }
+                if ((this->flags[target] & Border) || this->contacts[target] > 0){
+                    this->freeze(target);
+                }
+                else{
+                    this->schedule(target);
+                }
+                return;
+            }
+        }
+        // Runs to the end and returns the absorption time.
+        double relax(){
+            while (this->is_running()){
+                this->step();
+            }
+            return this->now;
+        }
+};
+
+// Mean absorption time of KineticCrystal over every placement of
+// disloc_number dislocations on a crystal of side size, each relaxed
+// repeat_number times; run i relaxes placement i mod C(N, K) with draws
+// from RunKey{point seed, i}, as in test_run. The times are summed in
+// fixed blocks of runs and the blocks in order, so the result depends only
+// on the seed and not on the number of workers.
+template <unsigned int Dim>
+long double kinetic_run(unsigned int disloc_number, unsigned int size, int repeat_number,
+                        std::uint64_t seed = random_seed(), ThreadPool& pool = default_pool()){
+    unsigned int N = 1;
+    for (unsigned int d = 0; d < Dim; d++){
+        N *= size;
+    }
+    const unsigned long long block = 4096;
+    unsigned long long total = binomial(N, disloc_number) * repeat_number;
+    unsigned long long blocks = (total + block - 1) / block;
+    unsigned int threads = pool.size();
+    std::uint64_t key = point_seed(seed, Dim, size, disloc_number);
+    std::vector<long double> sums(blocks, 0);
+
+    pool.run([&](unsigned int worker){
+        unsigned long long first = blocks * worker / threads;
+        unsigned long long last = blocks * (worker + 1) / threads;
+        if (first == last){
+            return;
+        }
+        bool* scheme = new bool[N];
+        Placements placements(N, disloc_number, first * block);
+        placements.write(scheme);
+        KineticCrystal<Dim> crystal(scheme, size, RunKey{key, first * block});
+        for (unsigned long long b = first; b < last; b++){
+            for (unsigned long long run = b * block; run < std::min(total, (b + 1) * block); run++){
+                placements.write(scheme);
+                crystal.reset(SchemeView(scheme, N), RunKey{key, run});
+                sums[b] += crystal.relax();
+                count_event(RunStep, crystal.hop_number());
+                count_event(RunEnd);
+                placements.next();
+            }
+        }
+        delete[] scheme;
+    });
+
+    long double time = 0;
+    for (long double s : sums){
+        time += s;
+    }
+    return time / total;
+}
+
+#endif
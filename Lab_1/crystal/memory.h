@@ -0,0 +1,78 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Allocates the planes of the engines. Blocks of at least huge_page bytes
+// are mapped directly and marked for transparent huge pages, so a sweep
+// over a lattice of 4096x4096 or more is not held up by TLB misses on
+// every few rows; smaller blocks come from the usual heap. Where
+// madvise(MADV_HUGEPAGE) is unknown the mapping is kept with normal pages.
+template <typename T>
+class HugePageAllocator{
+    public:
+        typedef T value_type;
+        static constexpr std::size_t huge_page = std::size_t(2) << 20;
+
+        HugePageAllocator() = default;
+        template <typename U>
+        HugePageAllocator(const HugePageAllocator<U>&){}
+
+        T* allocate(std::size_t n){
+            std::size_t bytes = n * sizeof(T);
+#if defined(__linux__)
+            if (bytes >= huge_page){
+                // mmap only promises page alignment, so map one huge page
+                // more than needed and unmap the slack on either side of
+                // the first 2 MiB boundary.
+                bytes = (bytes + huge_page - 1) / huge_page * huge_page;
+                void* base = mmap(nullptr, bytes + huge_page, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (base == MAP_FAILED){
+                    throw std::bad_alloc();
+                }
+                char* start = static_cast<char*>(base);
+                char* p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(start) + huge_page - 1)
+                                                  / huge_page * huge_page);
+                if (p > start){
+                    munmap(start, p - start);
+                }
+                munmap(p + bytes, start + huge_page - p);
+#ifdef MADV_HUGEPAGE
+                madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+                return reinterpret_cast<T*>(p);
+            }
+#endif
+            return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T* p, std::size_t n){
+            std::size_t bytes = n * sizeof(T);
+#if defined(__linux__)
+            if (bytes >= huge_page){
+                munmap(p, (bytes + huge_page - 1) / huge_page * huge_page);
+                return;
+            }
+#endif
+            std::allocator<T>().deallocate(p, n);
+        }
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&){
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&){
+    return false;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that all run the same job, each with its
+// own worker number, so the caller decides the split of the work and the
+// split does not depend on scheduling.
+class ThreadPool{
+    private:
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::function<void(unsigned int)> job;
+        unsigned long long generation;
+        unsigned int pending;
+        bool stopping;
+
+        void work(unsigned int worker){
+            unsigned long long seen = 0;
+            while (true){
+                std::function<void(unsigned int)> current;
+                {
+                    std::unique_lock<std::mutex> guard(this->lock);
+                    this->wake.wait(guard, [this, seen]{
+                        return this->stopping || this->generation != seen;
+                    });
+                    if (this->stopping){
+                        return;
+                    }
+                    seen = this->generation;
+                    current = this->job;
+                }
+                current(worker);
+                std::lock_guard<std::mutex> guard(this->lock);
+                if (--this->pending == 0){
+                    this->done.notify_all();
+                }
+            }
+        }
+    public:
+        explicit ThreadPool(unsigned int threads){
+            this->generation = 0;
+            this->pending = 0;
+            this->stopping = false;
+            if (threads == 0){
+                threads = 1;
+            }
+            for (unsigned int t = 0; t < threads; t++){
+                this->workers.emplace_back(&ThreadPool::work, this, t);
+            }
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->stopping = true;
+            }
+            this->wake.notify_all();
+            for (std::thread& worker : this->workers){
+                worker.join();
+            }
+        }
+        unsigned int size(){
+            return this->workers.size();
+        }
+        // Runs job(worker) once on every worker and waits for all of them.
+        void run(std::function<void(unsigned int)> job){
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->job = job;
+            this->pending = this->workers.size();
+            this->generation++;
+            this->wake.notify_all();
+            this->done.wait(guard, [this]{
+                return this->pending == 0;
+            });
+        }
+};
+
+// Pool shared by the sweeps, one worker per hardware thread.
+inline ThreadPool& default_pool(){
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+#endif
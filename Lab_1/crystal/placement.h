@@ -0,0 +1,135 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// C(n, k). Every partial product C(n - k + i, i) * (n - k + i + 1) is
+// formed in 128 bits, so the result is exact whenever it fits in 64.
+inline unsigned long long binomial(unsigned int n, unsigned int k){
+    if (k > n){
+        return 0;
+    }
+    k = std::min(k, n - k);
+    unsigned __int128 result = 1;
+    for (unsigned int i = 1; i <= k; i++){
+        result = result * (n - k + i) / i;
+        if (result > UINT64_MAX){
+            throw std::overflow_error("C(" + std::to_string(n) + ", " + std::to_string(k) +
+                                      ") does not fit in 64 bits");
+        }
+    }
+    return (unsigned long long) result;
+}
+
+// The placements of K dislocations on N sites in the order test_run has
+// always used: prev_permutation of a bitmask that starts with K ones, i.e.
+// the first placement fills sites 0..K-1 and the stream wraps around after
+// the last. Any rank can be reached directly, so ranges of the stream can
+// be handed to threads or processes.
+//
+// Up to 64 sites the stream keeps the empty sites as a mask with site i on
+// bit N - 1 - i. In that form the order is plain increasing order of the
+// mask, which Gosper's hack steps in a few instructions and which colex
+// ranks unrank. Larger lattices fall back to the bitmask string.
+class Placements{
+    private:
+        unsigned int N;
+        unsigned int K;
+        unsigned long long count;
+        unsigned long long position;
+        std::uint64_t holes;
+        std::string bitmask;
+
+        bool small(){
+            return this->N <= 64;
+        }
+        std::uint64_t full(){
+            return this->N == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << this->N) - 1;
+        }
+        static std::uint64_t next_combination(std::uint64_t x){
+            std::uint64_t low = x & (~x + 1);
+            std::uint64_t ripple = x + low;
+            return ripple | (((x ^ ripple) >> 2) / low);
+        }
+    public:
+        Placements(unsigned int N, unsigned int K, unsigned long long rank = 0){
+            this->N = N;
+            this->K = K;
+            this->count = binomial(N, K);
+            this->seek(rank);
+        }
+        unsigned long long size(){
+            return this->count;
+        }
+        unsigned long long rank(){
+            return this->position;
+        }
+        // Jumps to placement rank mod size().
+        void seek(unsigned long long rank){
+            rank %= this->count;
+            this->position = rank;
+            if (this->small()){
+                this->holes = 0;
+                unsigned int p = this->N;
+                for (unsigned int i = this->N - this->K; i > 0; i--){
+                    do {
+                        p--;
+                    } while (binomial(p, i) > rank);
+                    this->holes |= std::uint64_t(1) << p;
+                    rank -= binomial(p, i);
+                }
+                return;
+            }
+            unsigned int k = this->K;
+            this->bitmask.assign(this->N, 0);
+            for (unsigned int i = 0; i < this->N && k > 0; i++){
+                unsigned long long leading = binomial(this->N - i - 1, k - 1);
+                if (rank < leading){
+                    this->bitmask[i] = 1;
+                    k--;
+                }
+                else{
+                    rank -= leading;
+                }
+            }
+        }
+        void next(){
+            if (++this->position == this->count){
+                this->seek(0);
+            }
+            else if (this->small()){
+                this->holes = next_combination(this->holes);
+            }
+            else{
+                std::prev_permutation(this->bitmask.begin(), this->bitmask.end());
+            }
+        }
+        // Calls f(site) for every occupied site, in increasing order.
+        template <typename F>
+        void for_each_site(F f){
+            if (this->small()){
+                for (std::uint64_t occupied = ~this->holes & this->full(); occupied; ){
+                    unsigned int b = 63 - __builtin_clzll(occupied);
+                    f(this->N - 1 - b);
+                    occupied ^= std::uint64_t(1) << b;
+                }
+                return;
+            }
+            for (unsigned int i = 0; i < this->N; i++){
+                if (this->bitmask[i]){
+                    f(i);
+                }
+            }
+        }
+        void write(bool* scheme){
+            std::fill_n(scheme, this->N, false);
+            this->for_each_site([scheme](unsigned int site){
+                scheme[site] = true;
+            });
+        }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+// Counter-based random numbers. A generator is a pure function of
+// (seed, run, step, block) returning 128 bits, so any run, step or part of
+// the lattice can be drawn by any thread in any order and still give the
+// same numbers. Engines draw from block = row * chunks + column / per_block,
+// which lets one call cover up to 128 sites.
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+// 1, 2, 3", SC'11). The 64-bit seed is the key; the counter holds the low
+// 32 bits of block and step and all 64 bits of run.
+struct Philox{
+    static void generate(std::uint64_t seed, std::uint64_t run, std::uint64_t step,
+                         std::uint64_t block, std::uint64_t out[2]){
+        std::uint32_t k0 = std::uint32_t(seed);
+        std::uint32_t k1 = std::uint32_t(seed >> 32);
+        std::uint32_t c0 = std::uint32_t(block);
+        std::uint32_t c1 = std::uint32_t(step);
+        std::uint32_t c2 = std::uint32_t(run);
+        std::uint32_t c3 = std::uint32_t(run >> 32);
+        for (int round = 0; round < 10; round++){
+            std::uint64_t p0 = std::uint64_t(0xD2511F53) * c0;
+            std::uint64_t p1 = std::uint64_t(0xCD9E8D57) * c2;
+            std::uint32_t n0 = std::uint32_t(p1 >> 32) ^ c1 ^ k0;
+            std::uint32_t n2 = std::uint32_t(p0 >> 32) ^ c3 ^ k1;
+            c1 = std::uint32_t(p1);
+            c3 = std::uint32_t(p0);
+            c0 = n0;
+            c2 = n2;
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        out[0] = (std::uint64_t(c1) << 32) | c0;
+        out[1] = (std::uint64_t(c3) << 32) | c2;
+    }
+};
+
+// A cheaper keyed hash built from the SplitMix64 finaliser, several times
+// faster than Philox and good enough for the walk statistics.
+struct SplitMix{
+    static std::uint64_t mix(std::uint64_t x){
+        x += 0x9E3779B97F4A7C15;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+        return x ^ (x >> 31);
+    }
+    static void generate(std::uint64_t seed, std::uint64_t run, std::uint64_t step,
+                         std::uint64_t block, std::uint64_t out[2]){
+        std::uint64_t h = mix(seed ^ mix(run));
+        h = mix(h ^ (step << 32 | std::uint32_t(block)));
+        out[0] = mix(h);
+        out[1] = mix(h ^ 0x6A09E667F3BCC909);
+    }
+};
+
+typedef Philox DefaultGenerator;
+
+// Identifies one relaxation: the sweep seed and the number of the run in it.
+struct RunKey{
+    std::uint64_t seed;
+    std::uint64_t run;
+};
+
+inline std::uint64_t random_seed(){
+    std::random_device rdev;
+    return (std::uint64_t(rdev()) << 32) | rdev();
+}
+
+// Seed for one point of a sweep, so that run numbers can restart from zero
+// at every point without reusing streams.
+inline std::uint64_t point_seed(std::uint64_t seed, std::uint64_t a, std::uint64_t b, std::uint64_t c){
+    return SplitMix::mix(SplitMix::mix(SplitMix::mix(seed ^ a) ^ b) ^ c);
+}
+
+// Uniform directions in [0, Count) for every site of every step of a run.
+// Power-of-two counts take log2(Count) bits per site, so a 4-way lattice
+// gets 64 directions from one generator call; other counts take 32 bits
+// per site and map them with a multiply-shift.
+template <unsigned int Count, class Generator = DefaultGenerator>
+class Directions{
+    public:
+        static constexpr bool packed = (Count & (Count - 1)) == 0;
+        static constexpr unsigned int bits = !packed ? 32 : Count <= 2 ? 1 : Count <= 4 ? 2
+                                           : Count <= 16 ? 4 : 8;
+        static constexpr unsigned int per_block = 128 / bits;
+    private:
+        RunKey key;
+        std::uint64_t chunks;
+        std::uint64_t cached_step;
+        std::uint64_t cached_block;
+        std::uint64_t cache[2];
+    public:
+        Directions(RunKey key, unsigned int width){
+            this->key = key;
+            this->chunks = (width + per_block - 1) / per_block;
+            this->cached_step = std::numeric_limits<std::uint64_t>::max();
+            this->cached_block = 0;
+        }
+        // The 128 bits holding the directions of columns
+        // [chunk * per_block, (chunk + 1) * per_block) of row at step.
+        void block(std::uint64_t step, std::uint64_t row, std::uint64_t chunk, std::uint64_t out[2]){
+            Generator::generate(this->key.seed, this->key.run, step,
+                                row * this->chunks + chunk, out);
+        }
+        unsigned int get(std::uint64_t step, std::uint64_t row, unsigned int column){
+            std::uint64_t b = row * this->chunks + column / per_block;
+            if (b != this->cached_block || step != this->cached_step){
+                Generator::generate(this->key.seed, this->key.run, step, b, this->cache);
+                this->cached_block = b;
+                this->cached_step = step;
+            }
+            unsigned int slot = column % per_block * bits;
+            std::uint64_t word = this->cache[slot / 64] >> (slot % 64);
+            if (packed){
+                return word & (Count - 1);
+            }
+            return (std::uint32_t(word) * std::uint64_t(Count)) >> 32;
+        }
+};
+
+// Standard UniformRandomBitGenerator over the same counters, for the
+// ordinary draws of the drivers such as random initial schemes. It uses a
+// step number no relaxation reaches, so it never repeats engine draws.
+template <class Generator = DefaultGenerator>
+class CounterGenerator{
+    private:
+        RunKey key;
+        std::uint64_t counter;
+        std::uint64_t cache[2];
+    public:
+        typedef std::uint64_t result_type;
+        explicit CounterGenerator(RunKey key){
+            this->key = key;
+            this->counter = 0;
+        }
+        static constexpr result_type min(){
+            return 0;
+        }
+        static constexpr result_type max(){
+            return std::numeric_limits<result_type>::max();
+        }
+        result_type operator()(){
+            if (this->counter % 2 == 0){
+                Generator::generate(this->key.seed, this->key.run, 0xFFFFFFFF,
+                                    this->counter / 2, this->cache);
+            }
+            return this->cache[this->counter++ % 2];
+        }
+};
+
+#endif
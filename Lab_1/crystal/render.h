@@ -0,0 +1,202 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+// Draws a chain or a plane in the terminal with ANSI escapes. Every frame
+// is built in one string and written with a single call, and only the
+// screen cells that changed since the last frame are redrawn. A lattice
+// larger than the terminal is shown downsampled: each screen cell covers
+// a block of sites and is shaded by the fraction of them that hold a
+// dislocation.
+class Renderer{
+    private:
+        std::size_t rows;
+        std::size_t cols;
+        std::size_t block_rows;
+        std::size_t block_cols;
+        std::size_t screen_rows;
+        std::size_t screen_cols;
+        // Shade of every screen cell on the screen now, or 0xff before the
+        // first frame.
+        std::vector<unsigned char> shown;
+        std::vector<unsigned int> counts;
+        std::string status;
+        std::string frame;
+
+        static const char* glyph(unsigned char shade, bool single){
+            static const char* shades[5] = {" ", "░", "▒", "▓", "█"};
+            if (single){
+                return shade ? "■" : " ";
+            }
+            return shades[shade];
+        }
+        void move_to(std::size_t row, std::size_t col){
+            this->frame += "\x1b[" + std::to_string(row + 1) + ";" + std::to_string(col + 1) + "H";
+        }
+    public:
+        // A lattice of rows x cols sites (rows = 1 for a chain).
+        Renderer(std::size_t rows, std::size_t cols){
+            std::size_t term_rows = 24;
+            std::size_t term_cols = 80;
+#if defined(__unix__) || defined(__APPLE__)
+            winsize window;
+            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_row > 2 && window.ws_col > 0){
+                term_rows = window.ws_row;
+                term_cols = window.ws_col;
+            }
+#endif
+            this->rows = rows;
+            this->cols = cols;
+            // Two lines are kept for the status and the prompt.
+            this->block_rows = (rows + term_rows - 3) / (term_rows - 2);
+            this->block_cols = (cols + term_cols - 1) / term_cols;
+            this->screen_rows = (rows + this->block_rows - 1) / this->block_rows;
+            this->screen_cols = (cols + this->block_cols - 1) / this->block_cols;
+            this->shown.assign(this->screen_rows * this->screen_cols, 0xff);
+            this->counts.assign(this->shown.size(), 0);
+            std::fputs("\x1b[?25l\x1b[2J", stdout);
+        }
+        Renderer(const Renderer&) = delete;
+        Renderer& operator=(const Renderer&) = delete;
+        ~Renderer(){
+            this->move_to(this->screen_rows + 1, 0);
+            std::fputs((this->frame + "\x1b[?25h\n").c_str(), stdout);
+            std::fflush(stdout);
+        }
+        // Copies the state of every site of crystal into sites, one byte
+        // per site. Cheap enough to run on the simulation thread.
+        template <class Engine>
+        void capture(Engine& crystal, std::vector<unsigned char>& sites){
+            sites.resize(this->rows * this->cols);
+            for (std::size_t i = 0; i < sites.size(); i++){
+                sites[i] = crystal.is_dislocation(i);
+            }
+        }
+        // Redraws the screen cells whose shade changed and the status line.
+        void draw_sites(const std::vector<unsigned char>& sites, const std::string& status){
+            std::fill(this->counts.begin(), this->counts.end(), 0);
+            for (std::size_t r = 0; r < this->rows; r++){
+                unsigned int* line = this->counts.data() + r / this->block_rows * this->screen_cols;
+                const unsigned char* s = sites.data() + r * this->cols;
+                for (std::size_t c = 0; c < this->cols; c++){
+                    line[c / this->block_cols] += s[c];
+                }
+            }
+
+            bool single = this->block_rows == 1 && this->block_cols == 1;
+            this->frame.clear();
+            std::size_t cursor = std::size_t(-1);
+            for (std::size_t y = 0; y < this->screen_rows; y++){
+                std::size_t height = std::min(this->block_rows, this->rows - y * this->block_rows);
+                for (std::size_t x = 0; x < this->screen_cols; x++){
+                    std::size_t width = std::min(this->block_cols, this->cols - x * this->block_cols);
+                    std::size_t k = y * this->screen_cols + x;
+                    unsigned int n = this->counts[k];
+                    std::size_t area = height * width;
+                    // Any dislocation at all shows at least the lightest shade.
+                    unsigned char shade = n == 0 ? 0 : std::max<std::size_t>(1, (4 * n + area - 1) / area);
+                    if (shade == this->shown[k]){
+                        continue;
+                    }
+                    if (cursor != k){
+                        this->move_to(y, x);
+                    }
+                    this->frame += glyph(shade, single);
+                    this->shown[k] = shade;
+                    cursor = x + 1 < this->screen_cols ? k + 1 : std::size_t(-1);
+                }
+            }
+            if (status != this->status){
+                this->move_to(this->screen_rows, 0);
+                this->frame += "\x1b[2K" + status;
+                this->status = status;
+            }
+            this->move_to(this->screen_rows + 1, 0);
+            std::fwrite(this->frame.data(), 1, this->frame.size(), stdout);
+            std::fflush(stdout);
+        }
+        template <class Engine>
+        void draw(Engine& crystal, const std::string& status){
+            std::vector<unsigned char> sites;
+            this->capture(crystal, sites);
+            this->draw_sites(sites, status);
+        }
+};
+
+// Steps crystal on the calling thread as fast as it goes until it stops,
+// while a render thread shows it fps times a second. The render thread
+// only asks for a snapshot; the stepping thread copies one between two
+// steps, so the engine is never read while it changes.
+template <class Engine>
+unsigned long long free_run(Engine& crystal, Renderer& renderer, double fps){
+    std::mutex lock;
+    std::condition_variable ready;
+    std::vector<unsigned char> snapshot;
+    unsigned long long snapshot_steps = 0;
+    std::atomic<bool> wanted(false);
+    bool finished = false;
+
+    auto status = [](unsigned long long steps, bool done){
+        return "step " + std::to_string(steps) + (done ? ", relaxed" : ", running");
+    };
+    std::thread render([&]{
+        auto period = std::chrono::duration<double>(1.0 / fps);
+        auto next = std::chrono::steady_clock::now();
+        while (true){
+            next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            std::this_thread::sleep_until(next);
+            std::unique_lock<std::mutex> guard(lock);
+            if (finished){
+                return;
+            }
+            wanted = true;
+            ready.wait(guard, [&]{
+                return !wanted || finished;
+            });
+            if (finished){
+                return;
+            }
+            // The snapshot is not touched again until the next request.
+            guard.unlock();
+            renderer.draw_sites(snapshot, status(snapshot_steps, false));
+        }
+    });
+
+    unsigned long long steps = 0;
+    while (crystal.is_running()){
+        crystal.step();
+        steps++;
+        if (wanted.load(std::memory_order_relaxed)){
+            std::lock_guard<std::mutex> guard(lock);
+            renderer.capture(crystal, snapshot);
+            snapshot_steps = steps;
+            wanted = false;
+            ready.notify_one();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+        ready.notify_one();
+    }
+    render.join();
+    renderer.draw(crystal, status(steps, true));
+    return steps;
+}
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bitboard.h"
+#include "crystal.h"
+#include "experiment.h"
+#include "instrument.h"
+#include "placement.h"
+#include "random.h"
+
+// Many independent runs of one small lattice, stepped in lockstep. The
+// planes are laid out replica-minor: every site holds `words` 64-bit words
+// with one bit per replica, so contacts, conflicts and moves of all
+// replicas are resolved together with the same word operations BitCrystal
+// uses along a row. Only the direction draws are made per replica, from
+// the same keyed counters as Crystal, so every replica relaxes exactly as
+// cycle() would relax it on its own.
+//
+// A replica that has stopped is refilled at once from the run source, and
+// once the source runs dry the live replicas are packed into the leading
+// words so that the tail of a batch does not step empty ones. Every batch
+// starts from clear lanes, so one engine can relax a whole sweep.
+template <unsigned int Dim>
+class ReplicaCrystal{
+    public:
+        typedef Neighbourhood<Dim> Stencil;
+        typedef std::array<unsigned int, Dim> Extent;
+        typedef Directions<Stencil::size> Random;
+        static constexpr std::size_t words = 8;
+        static constexpr unsigned int replicas = 64 * words;
+    private:
+        Extent extent;
+        unsigned int width;
+        std::size_t size;
+        std::array<std::ptrdiff_t, Stencil::size> offset;
+        std::array<unsigned int, Stencil::size> priority;
+        std::vector<std::size_t> interior;
+        std::vector<bool> is_interior;
+        // Number of leading words that may hold live replicas.
+        std::size_t span;
+
+        std::vector<std::uint64_t> state;
+        std::vector<std::uint64_t> next;
+        std::vector<std::uint64_t> active;
+        std::array<std::vector<std::uint64_t>, Stencil::size> moves;
+        std::array<std::uint64_t, words> live;
+        std::array<std::uint64_t, words> running;
+
+        std::vector<Random> directions;
+        std::vector<std::uint64_t> steps;
+        std::vector<unsigned long long> slot;
+        std::unique_ptr<bool[]> scheme;
+
+        std::uint64_t* site(std::vector<std::uint64_t>& plane, std::size_t s){
+            return plane.data() + s * words;
+        }
+        void set_bit(std::vector<std::uint64_t>& plane, std::size_t s, unsigned int lane, bool value){
+            std::uint64_t bit = std::uint64_t(1) << (lane % 64);
+            std::uint64_t& w = this->site(plane, s)[lane / 64];
+            w = value ? (w | bit) : (w & ~bit);
+        }
+        bool get_bit(std::vector<std::uint64_t>& plane, std::size_t s, unsigned int lane){
+            return (this->site(plane, s)[lane / 64] >> (lane % 64)) & 1;
+        }
+        // Starts run index with key in lane, which must be clear; its
+        // dislocations are set separately.
+        void start(unsigned int lane, RunKey key, unsigned long long index){
+            for (std::size_t s : this->interior){
+                this->set_bit(this->active, s, lane, true);
+            }
+            this->directions[lane] = Random(key, this->width);
+            this->steps[lane] = 0;
+            this->slot[lane] = index;
+            this->live[lane / 64] |= std::uint64_t(1) << (lane % 64);
+        }
+        void clear(unsigned int lane){
+            for (std::size_t s = 0; s < this->size; s++){
+                this->set_bit(this->state, s, lane, false);
+                this->set_bit(this->active, s, lane, false);
+            }
+            this->live[lane / 64] &= ~(std::uint64_t(1) << (lane % 64));
+        }
+        // Moves replica from into the free lane to.
+        void transplant(unsigned int from, unsigned int to){
+            for (std::size_t s = 0; s < this->size; s++){
+                this->set_bit(this->state, s, to, this->get_bit(this->state, s, from));
+                this->set_bit(this->active, s, to, this->get_bit(this->active, s, from));
+            }
+            this->directions[to] = this->directions[from];
+            this->steps[to] = this->steps[from];
+            this->slot[to] = this->slot[from];
+            this->live[to / 64] |= std::uint64_t(1) << (to % 64);
+            this->clear(from);
+        }
+        // Packs the live replicas into the leading words and shrinks span
+        // to the lane words that still hold any.
+        void compact(){
+            unsigned int count = 0;
+            for (std::size_t k = 0; k < this->span; k++){
+                count += __builtin_popcountll(this->live[k]);
+            }
+            std::size_t needed = (count + 63) / 64;
+            needed = std::max<std::size_t>(Lane::width, (needed + Lane::width - 1) / Lane::width * Lane::width);
+            if (needed >= this->span){
+                return;
+            }
+            unsigned int free_lane = 0;
+            for (unsigned int lane = needed * 64; lane < this->span * 64; lane++){
+                if (!((this->live[lane / 64] >> (lane % 64)) & 1)){
+                    continue;
+                }
+                while ((this->live[free_lane / 64] >> (free_lane % 64)) & 1){
+                    free_lane++;
+                }
+                this->transplant(lane, free_lane);
+            }
+            this->span = needed;
+            this->check_activity();
+        }
+        // Number of replica bits set in both planes over the interior, for
+        // the instrumentation counts.
+        std::uint64_t count_common(std::vector<std::uint64_t>& plane, std::vector<std::uint64_t>& mask){
+            std::uint64_t n = 0;
+            for (std::size_t s : this->interior){
+                std::uint64_t* p = this->site(plane, s);
+                std::uint64_t* m = this->site(mask, s);
+                for (std::size_t k = 0; k < this->span; k++){
+                    n += __builtin_popcountll(p[k] & m[k]);
+                }
+            }
+            return n;
+        }
+        void update_activity(){
+            PhaseTimer timer(ActivityUpdate);
+            std::uint64_t before = 0;
+            if constexpr (instrumented){
+                before = this->count_common(this->state, this->active);
+            }
+            for (std::size_t s : this->interior){
+                for (std::size_t k = 0; k < this->span; k += Lane::width){
+                    Lane::Word contact = Lane::zero();
+                    for (unsigned int d = 0; d < Stencil::size; d++){
+                        contact = Lane::bit_or(contact, Lane::load(this->site(this->state, s + this->offset[d]) + k));
+                    }
+                    contact = Lane::bit_and(contact, Lane::load(this->site(this->state, s) + k));
+                    std::uint64_t* a = this->site(this->active, s) + k;
+                    Lane::store(a, Lane::and_not(Lane::load(a), contact));
+                }
+            }
+            if constexpr (instrumented){
+                count_event(Deactivation, before - this->count_common(this->state, this->active));
+            }
+        }
+        void check_activity(){
+            PhaseTimer timer(ActivityCheck);
+            this->running.fill(0);
+            for (std::size_t s : this->interior){
+                std::uint64_t* st = this->site(this->state, s);
+                std::uint64_t* a = this->site(this->active, s);
+                for (std::size_t k = 0; k < this->span; k++){
+                    this->running[k] |= st[k] & a[k];
+                }
+            }
+        }
+        void calculate_state(){
+            PhaseTimer timer(StateCalculation);
+            std::uint64_t proposed = 0;
+            if constexpr (instrumented){
+                proposed = this->count_common(this->state, this->active);
+            }
+            for (std::size_t s : this->interior){
+                std::uint64_t* st = this->site(this->state, s);
+                std::uint64_t* a = this->site(this->active, s);
+                std::size_t row = s / this->width;
+                unsigned int column = s % this->width;
+                for (unsigned int d = 0; d < Stencil::size; d++){
+                    std::fill_n(this->site(this->moves[d], s), this->span, 0);
+                }
+                for (std::size_t k = 0; k < this->span; k++){
+                    std::uint64_t movers = st[k] & a[k];
+                    while (movers){
+                        unsigned int lane = k * 64 + __builtin_ctzll(movers);
+                        unsigned int d = this->directions[lane].get(this->steps[lane], row, column);
+                        this->site(this->moves[d], s)[k] |= movers & (~movers + 1);
+                        movers &= movers - 1;
+                    }
+                }
+            }
+            for (std::size_t k = 0; k < this->span; k++){
+                for (std::uint64_t r = this->running[k]; r; r &= r - 1){
+                    this->steps[k * 64 + __builtin_ctzll(r)]++;
+                }
+            }
+
+            // Grant every contested site to the first mover in scan order.
+            for (std::size_t t = 0; t < this->size; t++){
+                std::uint64_t* taken = this->site(this->next, t);
+                std::fill_n(taken, this->span, 0);
+                for (unsigned int d : this->priority){
+                    std::size_t src = t - this->offset[d];
+                    if (src >= this->size || !this->is_interior[src]){
+                        continue;
+                    }
+                    std::uint64_t* m = this->site(this->moves[d], src);
+                    for (std::size_t k = 0; k < this->span; k += Lane::width){
+                        Lane::Word in = Lane::load(m + k);
+                        Lane::Word t_k = Lane::load(taken + k);
+                        Lane::store(m + k, Lane::and_not(in, t_k));
+                        Lane::store(taken + k, Lane::bit_or(t_k, in));
+                    }
+                }
+            }
+            if constexpr (instrumented){
+                std::uint64_t granted = 0;
+                for (unsigned int d = 0; d < Stencil::size; d++){
+                    granted += this->count_common(this->moves[d], this->moves[d]);
+                }
+                count_event(MoveProposed, proposed);
+                count_event(MoveBlocked, proposed - granted);
+            }
+        }
+        void update_state(){
+            PhaseTimer timer(StateUpdate);
+            for (std::size_t s = 0; s < this->size; s++){
+                std::uint64_t* st = this->site(this->state, s);
+                std::uint64_t* nx = this->site(this->next, s);
+                for (std::size_t k = 0; k < this->span; k += Lane::width){
+                    Lane::Word kept = Lane::load(st + k);
+                    if (this->is_interior[s]){
+                        Lane::Word moved = Lane::zero();
+                        for (unsigned int d = 0; d < Stencil::size; d++){
+                            moved = Lane::bit_or(moved, Lane::load(this->site(this->moves[d], s) + k));
+                        }
+                        kept = Lane::and_not(kept, moved);
+                    }
+                    Lane::store(st + k, Lane::bit_or(Lane::load(nx + k), kept));
+                }
+            }
+        }
+        // Relaxes count runs, calling load(lane, index) to start run index
+        // in a clear lane and retire(index, iterations) once it has stopped.
+        template <class Load, class Retire>
+        void relax(unsigned long long count, Load load, Retire retire){
+            unsigned long long issued = 0;
+            this->live.fill(0);
+            this->span = words;
+            std::fill(this->state.begin(), this->state.end(), 0);
+            std::fill(this->active.begin(), this->active.end(), 0);
+            for (unsigned int lane = 0; lane < replicas && issued < count; lane++, issued++){
+                load(lane, issued);
+            }
+
+            bool any = issued > 0;
+            while (any){
+                this->update_activity();
+                this->check_activity();
+
+                // Retire the replicas that have stopped (or hit the
+                // iteration cap) and refill their lanes; the refilled ones
+                // need their own activity pass before the step.
+                bool refilled = false;
+                for (std::size_t k = 0; k < this->span; k++){
+                    for (std::uint64_t l = this->live[k]; l; l &= l - 1){
+                        unsigned int lane = k * 64 + __builtin_ctzll(l);
+                        bool moving = (this->running[k] >> (lane % 64)) & 1;
+                        if (moving && this->steps[lane] < std::uint64_t(max_iterations)){
+                            continue;
+                        }
+                        retire(this->slot[lane], int(this->steps[lane]));
+                        count_event(RunStep, this->steps[lane]);
+                        count_event(RunEnd);
+                        this->clear(lane);
+                        if (issued < count){
+                            load(lane, issued++);
+                            refilled = true;
+                        }
+                    }
+                }
+                if (refilled){
+                    continue;
+                }
+                if (issued == count){
+                    this->compact();
+                }
+                any = false;
+                for (std::size_t k = 0; k < this->span; k++){
+                    any = any || this->live[k];
+                }
+                if (!any){
+                    break;
+                }
+                this->calculate_state();
+                this->update_state();
+            }
+        }
+        // Starts the runs of a test_run point straight from the placement
+        // stream, the i-th with RunKey{key, first + i}.
+        auto place(Placements& placements, std::uint64_t key, unsigned long long first){
+            return [this, &placements, key, first](unsigned int lane, unsigned long long index){
+                placements.for_each_site([this, lane](unsigned int s){
+                    this->set_bit(this->state, s, lane, true);
+                });
+                placements.next();
+                this->start(lane, RunKey{key, first + index}, index);
+            };
+        }
+    public:
+        ReplicaCrystal(Extent extent) : directions(replicas, Random(RunKey{0, 0}, extent[Dim - 1])){
+            static_assert(words % Lane::width == 0, "replica words must fill whole lanes");
+            this->extent = extent;
+            this->width = extent[Dim - 1];
+            this->size = 1;
+            for (unsigned int d = 0; d < Dim; d++){
+                this->size *= extent[d];
+            }
+            this->offset = Stencil::offsets(extent);
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                this->priority[d] = d;
+            }
+            std::array<std::ptrdiff_t, Stencil::size> offset = this->offset;
+            std::sort(this->priority.begin(), this->priority.end(),
+                      [&offset](unsigned int a, unsigned int b){
+                          return offset[a] > offset[b];
+                      });
+
+            this->is_interior.assign(this->size, true);
+            for (std::size_t i = 0; i < this->size; i++){
+                std::size_t rest = i;
+                for (int a = Dim - 1; a >= 0; a--){
+                    unsigned int coord = rest % extent[a];
+                    rest /= extent[a];
+                    if (coord == 0 || coord == extent[a] - 1){
+                        this->is_interior[i] = false;
+                    }
+                }
+                if (this->is_interior[i]){
+                    this->interior.push_back(i);
+                }
+            }
+
+            this->state.assign(this->size * words, 0);
+            this->next.assign(this->size * words, 0);
+            this->active.assign(this->size * words, 0);
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                this->moves[d].assign(this->size * words, 0);
+            }
+            this->steps.assign(replicas, 0);
+            this->slot.assign(replicas, 0);
+            this->scheme.reset(new bool[this->size]);
+        }
+        ReplicaCrystal(unsigned int side) : ReplicaCrystal(Crystal<Dim>::cube(side)){}
+
+        // Relaxes count runs and returns what cycle() returns for each, in
+        // order. source(scheme) writes the placement of the next run into
+        // scheme and returns its RunKey; it is called once per run, in order.
+        template <class Source>
+        std::vector<int> cycle_batch(unsigned long long count, Source source){
+            std::vector<int> iterations(count, 0);
+            this->relax(count,
+                        [&](unsigned int lane, unsigned long long index){
+                            RunKey key = source(this->scheme.get());
+                            for (std::size_t s = 0; s < this->size; s++){
+                                this->set_bit(this->state, s, lane, this->scheme[s]);
+                            }
+                            this->start(lane, key, index);
+                        },
+                        [&](unsigned long long index, int steps){
+                            iterations[index] = steps;
+                        });
+            return iterations;
+        }
+        // Relaxes count runs taken in order from placements, the i-th with
+        // RunKey{key, first + i}. Dislocations are set straight from the
+        // stream, without going through a scheme.
+        std::vector<int> cycle_batch(Placements& placements, std::uint64_t key,
+                                     unsigned long long first, unsigned long long count){
+            std::vector<int> iterations(count, 0);
+            this->relax(count, this->place(placements, key, first),
+                        [&](unsigned long long index, int steps){
+                            iterations[index] = steps;
+                        });
+            return iterations;
+        }
+        // The same runs, returning only their total, which needs no
+        // memory beyond the engine's own.
+        long long unsigned int sum_batch(Placements& placements, std::uint64_t key,
+                                         unsigned long long first, unsigned long long count){
+            long long unsigned int moves = 0;
+            this->relax(count, this->place(placements, key, first),
+                        [&moves](unsigned long long, int steps){
+                            moves += steps;
+                        });
+            return moves;
+        }
+};
+
+// Runs of a test_run point relaxed in replica batches: placements come from
+// the same stream as in the plain RunRange, so the sums match those of
+// Crystal exactly. Each thread keeps its batch engine between calls.
+template <unsigned int Dim>
+struct RunRange<Dim, ReplicaCrystal>{
+    static long long unsigned int sum(unsigned int disloc_number, unsigned int size, std::uint64_t key,
+                                      unsigned long long first, unsigned long long last){
+        unsigned int N = 1;
+        for (unsigned int d = 0; d < Dim; d++){
+            N *= size;
+        }
+        Placements placements(N, disloc_number, first);
+        ReplicaCrystal<Dim>& batch = pooled_engine<Dim, ReplicaCrystal>(size);
+        return batch.sum_batch(placements, key, first, last - first);
+    }
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "crystal.h"
+#include "instrument.h"
+#include "memory.h"
+#include "random.h"
+
+// Same model as Crystal<Dim>, kept as a list of the dislocations that are
+// still free to move plus, for every site, the number of neighbouring
+// dislocations. Counts are patched on each move, so deactivation, the
+// running check and the move proposals cost O(active dislocations) per
+// step instead of a scan of the whole lattice; only construction is O(N).
+template <unsigned int Dim>
+class SparseCrystal{
+    public:
+        typedef Neighbourhood<Dim> Stencil;
+        typedef std::array<unsigned int, Dim> Extent;
+    private:
+        enum Flag : unsigned char {Occupied = 1, Border = 2, Walker = 4};
+        static constexpr unsigned char no_heading = 0xff;
+        typedef std::vector<unsigned char, HugePageAllocator<unsigned char>> Plane;
+
+        Extent extent;
+        std::array<std::size_t, Dim> stride;
+        std::array<std::ptrdiff_t, Stencil::size> offset;
+        // axis[d] and sign[d] give the axis and sense of a move in direction d.
+        std::array<unsigned int, Stencil::size> axis;
+        std::array<int, Stencil::size> sign;
+        std::size_t size;
+        bool running;
+        Directions<Stencil::size> directions;
+        std::uint64_t steps;
+
+        Plane flags;
+        Plane contacts;
+        // Direction proposed by the walker on a site this step, or
+        // no_heading once the move has been refused.
+        Plane heading;
+        std::vector<std::size_t> walkers;
+
+        bool is_border(std::size_t index){
+            for (unsigned int a = 0; a < Dim; a++){
+                unsigned int coord = index / this->stride[a] % this->extent[a];
+                if (coord == 0 || coord == this->extent[a] - 1){
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Adds delta to the contact count of every neighbour of index.
+        // Only border sites need the coordinate check, since every
+        // neighbour of an interior site lies inside the lattice.
+        void touch_neighbours(std::size_t index, int delta){
+            bool border = this->flags[index] & Border;
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                if (border){
+                    unsigned int a = this->axis[d];
+                    long coord = index / this->stride[a] % this->extent[a];
+                    coord += this->sign[d];
+                    if (coord < 0 || coord >= long(this->extent[a])){
+                        continue;
+                    }
+                }
+                this->contacts[index + this->offset[d]] += delta;
+            }
+        }
+        void remove_walker(std::size_t k){
+            this->flags[this->walkers[k]] &= ~Walker;
+            this->walkers[k] = this->walkers.back();
+            this->walkers.pop_back();
+        }
+    public:
+        SparseCrystal(const bool* scheme, Extent extent, RunKey key = RunKey{random_seed(), 0})
+            : directions(key, extent[Dim - 1]){
+            this->extent = extent;
+            this->offset = Stencil::offsets(extent);
+            this->size = 1;
+            for (int a = Dim - 1; a >= 0; a--){
+                this->stride[a] = this->size;
+                this->size *= extent[a];
+            }
+            for (unsigned int d = 0; d < Stencil::size; d++){
+                std::size_t step = this->offset[d] < 0 ? -this->offset[d] : this->offset[d];
+                this->axis[d] = Dim - 1;
+                for (unsigned int a = 0; a < Dim; a++){
+                    if (this->stride[a] == step){
+                        this->axis[d] = a;
+                        break;
+                    }
+                }
+                this->sign[d] = this->offset[d] < 0 ? -1 : 1;
+            }
+            this->flags.assign(this->size, 0);
+            this->contacts.assign(this->size, 0);
+            this->heading.assign(this->size, no_heading);
+            for (std::size_t i = 0; i < this->size; i++){
+                if (this->is_border(i)){
+                    this->flags[i] |= Border;
+                }
+            }
+            this->reset(SchemeView(scheme, this->size), key);
+        }
+        SparseCrystal(const bool* scheme, unsigned int side, RunKey key = RunKey{random_seed(), 0})
+            : SparseCrystal(scheme, Crystal<Dim>::cube(side), key){}
+
+        // Starts a new run from scheme with the draws of key, keeping the
+        // planes and the capacity of the walker list.
+        void reset(SchemeView scheme, RunKey key){
+            if (scheme.size != this->size){
+                throw std::invalid_argument("scheme does not fit the crystal");
+            }
+            this->directions = Directions<Stencil::size>(key, this->extent[Dim - 1]);
+            this->running = true;
+            this->steps = 0;
+            this->walkers.clear();
+            std::fill(this->contacts.begin(), this->contacts.end(), 0);
+            std::fill(this->heading.begin(), this->heading.end(), no_heading);
+            for (std::size_t i = 0; i < this->size; i++){
+                this->flags[i] &= Border;
+            }
+            for (std::size_t i = 0; i < this->size; i++){
+                if (scheme[i]){
+                    this->flags[i] |= Occupied;
+                    this->touch_neighbours(i, 1);
+                    if (!(this->flags[i] & Border)){
+                        this->flags[i] |= Walker;
+                        this->walkers.push_back(i);
+                    }
+                }
+            }
+        }
+
+        bool is_running(){
+            return this->running;
+        }
+        bool is_dislocation(std::size_t index){
+            return this->flags[index] & Occupied;
+        }
+        std::size_t walker_number(){
+            return this->walkers.size();
+        }
+        void check_activity(){
+            PhaseTimer timer(ActivityCheck);
+            this->running = !this->walkers.empty();
+        }
+        void update_activity(){
+            PhaseTimer timer(ActivityUpdate);
+            for (std::size_t k = 0; k < this->walkers.size(); ){
+                if (this->contacts[this->walkers[k]] > 0){
+                    count_event(Deactivation);
+                    this->remove_walker(k);
+                }
+                else{
+                    k++;
+                }
+            }
+        }
+        void calculate_state(){
+            PhaseTimer timer(StateCalculation);
+            count_event(MoveProposed, this->walkers.size());
+            unsigned int width = this->extent[Dim - 1];
+            for (std::size_t site : this->walkers){
+                this->heading[site] = this->directions.get(this->steps, site / width, site % width);
+            }
+            this->steps++;
+            // A target wanted by several walkers goes to the one that comes
+            // first in scan order, i.e. the one moving along the larger offset.
+            for (std::size_t site : this->walkers){
+                unsigned int d = this->heading[site];
+                std::size_t target = site + this->offset[d];
+                for (unsigned int e = 0; e < Stencil::size; e++){
+                    if (this->offset[e] <= this->offset[d]){
+                        continue;
+                    }
+                    std::size_t rival = target - this->offset[e];
+                    if (rival < this->size && (this->flags[rival] & Walker)
+                        && this->heading[rival] == e){
+                        count_event(MoveBlocked);
+                        this->heading[site] = no_heading;
+                        break;
+                    }
+                }
+            }
+        }
+        void update_state(){
+            PhaseTimer timer(StateUpdate);
+            for (std::size_t k = 0; k < this->walkers.size(); ){
+                std::size_t site = this->walkers[k];
+                unsigned int d = this->heading[site];
+                this->heading[site] = no_heading;
+                if (d == no_heading){
+                    k++;
+                    continue;
+                }
+                std::size_t target = site + this->offset[d];
+                this->flags[site] &= ~(Occupied | Walker);
+                this->touch_neighbours(site, -1);
+                this->flags[target] |= Occupied;
+                this->touch_neighbours(target, 1);
+                if (this->flags[target] & Border){
+                    this->walkers[k] = this->walkers.back();
+                    this->walkers.pop_back();
+                }
+                else{
+                    this->flags[target] |= Walker;
+                    this->walkers[k] = target;
+                    k++;
+                }
+            }
+        }
+        void step(){
+            this->update_activity();
+            this->check_activity();
+            this->calculate_state();
+            this->update_state();
+        }
+};
+
+#endif
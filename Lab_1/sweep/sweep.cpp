@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../crystal/bitboard.h"
+#include "../crystal/checkpoint.h"
+#include "../crystal/exact.h"
+#include "../crystal/experiment.h"
+#include "../crystal/kinetic.h"
+#include "../crystal/replica.h"
+#include "../crystal/sparse.h"
+
+// Usage: sweep [--config FILE] [--KEY VALUE ...] [--merge]
+//
+// Runs the sweep that ratio_test and singular_test hardcode, with every
+// parameter taken from FILE, one "KEY VALUE" per line ('#' starts a
+// comment), and then from the command line, which wins:
+//
+//   dim      1, 2 or 3                                   (2)
+//   sizes    side range, "A-B" or "A"                    (1-5)
+//   k        dislocation range, "A-B", "A" or "all"      (all)
+//   repeats  runs per placement, "R" or a schedule
+//            "R,SIZE:R,..." switching at those sizes     (1000,4:100,5:10)
+//   seed     sweep seed                                  (random)
+//   engine   crystal, bit, sparse, replica, periodic, reflecting,
+//            moore, hex, kinetic, exact or first-passage (replica)
+//   format   ratio ("K/N mean") or singular ("size mean") lines (ratio)
+//   output   data file                                   (ratio_data)
+//   shard    "i/n": the i-th of n shares of the work       (0/1)
+//
+// The points (size, K) are visited by size, then K. The C(N, K) * repeats
+// runs of every point are cut into n contiguous ranges, and shard i
+// relaxes the i-th range of each point; it writes OUTPUT.shard-i-of-n with
+// one "POINT MOVES RUNS" line per point, its number, the move sum of its
+// runs and how many there were. --merge with the same configuration adds
+// up the shards of every point and writes OUTPUT. The engines without runs
+// to cut, kinetic, exact and first-passage, deal out whole points instead:
+// shard i takes every n-th point from the i-th and writes its number in
+// front of its line. Runs draw from keys fixed by the seed, so the merged
+// file is the one a single process would write. Sharded sweeps need an
+// explicit seed, shared by all shards. Each process keeps its own
+// checkpoint next to its output and resumes after an interruption.
+
+struct SweepConfig{
+    unsigned int dim = 2;
+    unsigned int min_size = 1;
+    unsigned int max_size = 5;
+    unsigned int min_k = 1;
+    unsigned int max_k = 0;
+    // repeats[s] runs per placement from size s on.
+    std::map<unsigned int, int> repeats = {{0, 1000}, {4, 100}, {5, 10}};
+    bool seeded = false;
+    std::uint64_t seed = 0;
+    std::string engine = "replica";
+    std::string format = "ratio";
+    std::string output = "ratio_data";
+    unsigned int shard = 0;
+    unsigned int shards = 1;
+
+    // Reads "A-B" or "A" into [low, high].
+    static void range(const std::string& value, unsigned int& low, unsigned int& high){
+        std::size_t dash = value.find('-');
+        low = std::stoul(value.substr(0, dash));
+        high = (dash == std::string::npos) ? low : std::stoul(value.substr(dash + 1));
+        if (low > high){
+            throw std::invalid_argument("empty range " + value);
+        }
+    }
+    void set(const std::string& key, const std::string& value){
+        if (key == "dim"){
+            this->dim = std::stoul(value);
+            if (this->dim < 1 || this->dim > 3){
+                throw std::invalid_argument("dim must be 1, 2 or 3");
+            }
+        }
+        else if (key == "sizes"){
+            range(value, this->min_size, this->max_size);
+        }
+        else if (key == "k"){
+            if (value == "all"){
+                this->min_k = 1;
+                this->max_k = 0;
+            }
+            else{
+                range(value, this->min_k, this->max_k);
+            }
+        }
+        else if (key == "repeats"){
+            this->repeats.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')){
+                std::size_t colon = item.find(':');
+                if (colon == std::string::npos){
+                    this->repeats[0] = std::stoi(item);
+                }
+                else{
+                    this->repeats[std::stoul(item.substr(0, colon))] = std::stoi(item.substr(colon + 1));
+                }
+            }
+            if (this->repeats.count(0) == 0){
+                throw std::invalid_argument("repeats needs a value for the smallest sizes");
+            }
+        }
+        else if (key == "seed"){
+            this->seed = std::stoull(value);
+            this->seeded = true;
+        }
+        else if (key == "engine"){
+            const std::vector<std::string> engines = {"crystal", "bit", "sparse", "replica", "periodic",
+                                                      "reflecting", "moore", "hex", "kinetic", "exact",
+                                                      "first-passage"};
+            if (std::find(engines.begin(), engines.end(), value) == engines.end()){
+                throw std::invalid_argument("unknown engine " + value);
+            }
+            this->engine = value;
+        }
+        else if (key == "format"){
+            if (value != "ratio" && value != "singular"){
+                throw std::invalid_argument("format must be ratio or singular");
+            }
+            this->format = value;
+        }
+        else if (key == "output"){
+            this->output = value;
+        }
+        else if (key == "shard"){
+            std::size_t slash = value.find('/');
+            if (slash == std::string::npos){
+                throw std::invalid_argument("shard must be i/n");
+            }
+            this->shard = std::stoul(value.substr(0, slash));
+            this->shards = std::stoul(value.substr(slash + 1));
+            if (this->shards == 0 || this->shard >= this->shards){
+                throw std::invalid_argument("shard " + value + " out of range");
+            }
+        }
+        else{
+            throw std::invalid_argument("unknown key " + key);
+        }
+    }
+    void load(const std::string& path){
+        std::ifstream file(path);
+        if (!file){
+            throw std::runtime_error("cannot read config " + path);
+        }
+        std::string line;
+        while (std::getline(file, line)){
+            line = line.substr(0, line.find('#'));
+            std::istringstream words(line);
+            std::string key, value;
+            if (!(words >> key)){
+                continue;
+            }
+            if (!(words >> value)){
+                throw std::invalid_argument("no value for " + key + " in " + path);
+            }
+            this->set(key, value);
+        }
+    }
+    int repeat_number(unsigned int size){
+        return std::prev(this->repeats.upper_bound(size))->second;
+    }
+    unsigned int sites(unsigned int size){
+        unsigned int N = 1;
+        for (unsigned int d = 0; d < this->dim; d++){
+            N *= size;
+        }
+        return N;
+    }
+    std::string shard_file(unsigned int shard){
+        return this->output + ".shard-" + std::to_string(shard) + "-of-" + std::to_string(this->shards);
+    }
+    // Whether the engine relaxes numbered runs, which shards can split.
+    bool splits_runs(){
+        return this->engine != "kinetic" && this->engine != "exact" && this->engine != "first-passage";
+    }
+};
+
+struct Point{
+    unsigned int size;
+    unsigned int K;
+};
+
+// Every point of the sweep, in the order the lines of the output follow.
+std::vector<Point> sweep_points(SweepConfig& config){
+    std::vector<Point> points;
+    for (unsigned int size = config.min_size; size <= config.max_size; size++){
+        unsigned int N = config.sites(size);
+        unsigned int last = config.max_k ? std::min(config.max_k, N) : N;
+        for (unsigned int K = config.min_k; K <= last; K++){
+            points.push_back(Point{size, K});
+        }
+    }
+    return points;
+}
+
+// Number of runs of a point: every placement, repeats times.
+unsigned long long point_runs(SweepConfig& config, Point point){
+    return binomial(config.sites(point.size), point.K) * config.repeat_number(point.size);
+}
+
+// Move sum of runs [begin, end) of a point, for the engines that split runs.
+template <unsigned int Dim>
+long long unsigned int measure_sum(SweepConfig& config, Checkpoint& checkpoint, Point point,
+                                   unsigned long long begin, unsigned long long end){
+    const std::string& engine = config.engine;
+    if (engine == "crystal"){
+        return checkpoint.test_sum<Dim, Crystal>(point.K, point.size, begin, end);
+    }
+    if (engine == "bit"){
+        return checkpoint.test_sum<Dim, BitCrystal>(point.K, point.size, begin, end);
+    }
+    if (engine == "sparse"){
+        return checkpoint.test_sum<Dim, SparseCrystal>(point.K, point.size, begin, end);
+    }
+    if (engine == "replica"){
+        return checkpoint.test_sum<Dim, ReplicaCrystal>(point.K, point.size, begin, end);
+    }
+    if (engine == "periodic"){
+        return checkpoint.test_sum<Dim, PeriodicCrystal>(point.K, point.size, begin, end);
+    }
+    if (engine == "reflecting"){
+        return checkpoint.test_sum<Dim, ReflectingCrystal>(point.K, point.size, begin, end);
+    }
+    if constexpr (Dim == 2){
+        if (engine == "moore"){
+            return checkpoint.test_sum<Dim, MooreCrystal>(point.K, point.size, begin, end);
+        }
+        if (engine == "hex"){
+            return checkpoint.test_sum<Dim, HexCrystal>(point.K, point.size, begin, end);
+        }
+    }
+    throw std::invalid_argument("no engine " + engine + " in " + std::to_string(Dim) + "D");
+}
+
+// Mean of a whole point, for the engines that do not split runs.
+template <unsigned int Dim>
+long double measure(SweepConfig& config, Checkpoint& checkpoint, Point point){
+    const std::string& engine = config.engine;
+    int repeat_number = config.repeat_number(point.size);
+    if (engine == "kinetic"){
+        return kinetic_run<Dim>(point.K, point.size, repeat_number, checkpoint.sweep_seed());
+    }
+    if (engine == "exact"){
+        return exact_run<Dim>(point.K, point.size);
+    }
+    if (engine == "first-passage"){
+        if (point.K != 1){
+            throw std::invalid_argument("first-passage needs k 1");
+        }
+        return first_passage_run<Dim>(point.size);
+    }
+    throw std::invalid_argument("no engine " + engine + " in " + std::to_string(Dim) + "D");
+}
+
+// The line of output for one point, without its newline.
+std::string format_line(SweepConfig& config, Point point, long double mean){
+    std::ostringstream line;
+    if (config.format == "singular"){
+        line << point.size << " " << mean;
+    }
+    else{
+        line << point.K * 1.0 / config.sites(point.size) << " " << mean;
+    }
+    return line.str();
+}
+
+// Runs this process's share of the sweep.
+void run_sweep(SweepConfig& config){
+    std::vector<Point> points = sweep_points(config);
+    bool sharded = config.shards > 1;
+    bool split = config.splits_runs();
+    std::string output = sharded ? config.shard_file(config.shard) : config.output;
+    Checkpoint checkpoint(output + ".checkpoint", output, config.seeded ? config.seed : random_seed());
+    std::ofstream file(output, checkpoint.mode());
+    for (std::size_t p = 0; p < points.size(); p++){
+        if (!split && p % config.shards != config.shard){
+            continue;
+        }
+        std::cout << points[p].size << " " << points[p].K << "\n";
+        if (checkpoint.skip()){
+            continue;
+        }
+        if (split){
+            unsigned long long total = point_runs(config, points[p]);
+            unsigned long long begin = (unsigned __int128)total * config.shard / config.shards;
+            unsigned long long end = (unsigned __int128)total * (config.shard + 1) / config.shards;
+            long long unsigned int moves = 0;
+            switch (config.dim){
+                case 1: moves = measure_sum<1>(config, checkpoint, points[p], begin, end); break;
+                case 2: moves = measure_sum<2>(config, checkpoint, points[p], begin, end); break;
+                case 3: moves = measure_sum<3>(config, checkpoint, points[p], begin, end); break;
+            }
+            if (sharded){
+                file << p << " " << moves << " " << end - begin << "\n";
+            }
+            else{
+                file << format_line(config, points[p], (long double)(moves) / total) << "\n";
+            }
+        }
+        else{
+            long double mean = 0;
+            switch (config.dim){
+                case 1: mean = measure<1>(config, checkpoint, points[p]); break;
+                case 2: mean = measure<2>(config, checkpoint, points[p]); break;
+                case 3: mean = measure<3>(config, checkpoint, points[p]); break;
+            }
+            if (sharded){
+                file << p << " ";
+            }
+            file << format_line(config, points[p], mean) << "\n";
+        }
+        checkpoint.finish(file);
+    }
+    file.close();
+    checkpoint.close();
+}
+
+// Gathers the shard files into output, checking that every shard holds
+// its part of every point exactly once.
+void merge_shards(SweepConfig& config){
+    std::vector<Point> points = sweep_points(config);
+    bool split = config.splits_runs();
+    std::vector<std::string> lines(points.size());
+    std::vector<long long unsigned int> moves(points.size(), 0);
+    std::vector<unsigned long long> runs(points.size(), 0);
+    // Number of shards that hold the point, and one past the last of them.
+    std::vector<unsigned int> found(points.size(), 0);
+    std::vector<unsigned int> last(points.size(), 0);
+    for (unsigned int s = 0; s < config.shards; s++){
+        std::string name = config.shard_file(s);
+        std::ifstream file(name);
+        if (!file){
+            throw std::runtime_error("missing shard " + name);
+        }
+        std::string line;
+        while (std::getline(file, line)){
+            std::istringstream fields(line);
+            std::size_t p;
+            if (!(fields >> p) || p >= points.size() || last[p] == s + 1
+                || (!split && p % config.shards != s)){
+                throw std::runtime_error("shard " + name + " does not belong to this sweep");
+            }
+            found[p]++;
+            last[p] = s + 1;
+            if (split){
+                long long unsigned int m;
+                unsigned long long r;
+                if (!(fields >> m >> r)){
+                    throw std::runtime_error("shard " + name + " does not belong to this sweep");
+                }
+                moves[p] += m;
+                runs[p] += r;
+            }
+            else{
+                lines[p] = line.substr(line.find(' ') + 1);
+            }
+        }
+    }
+    std::size_t missing = 0;
+    for (std::size_t p = 0; p < points.size(); p++){
+        if (split && found[p] == config.shards && runs[p] != point_runs(config, points[p])){
+            throw std::runtime_error("the shards do not cover the runs of point " + std::to_string(p));
+        }
+        missing += found[p] != (split ? config.shards : 1);
+    }
+    if (missing){
+        throw std::runtime_error(std::to_string(missing) + " points are not finished yet");
+    }
+    std::ofstream file(config.output, std::ios::out);
+    for (std::size_t p = 0; p < points.size(); p++){
+        if (split){
+            file << format_line(config, points[p], (long double)(moves[p]) / runs[p]) << "\n";
+        }
+        else{
+            file << lines[p] << "\n";
+        }
+    }
+}
+
+int main(int argc, char** argv){
+
+    SweepConfig config;
+    bool merge = false;
+    try {
+        for (int i = 1; i < argc; i++){
+            if (std::string(argv[i]) == "--config" && i + 1 < argc){
+                config.load(argv[i + 1]);
+            }
+        }
+        for (int i = 1; i < argc; i++){
+            std::string arg = argv[i];
+            if (arg == "--merge"){
+                merge = true;
+            }
+            else if (arg == "--config" && i + 1 < argc){
+                i++;
+            }
+            else if (arg.rfind("--", 0) == 0 && i + 1 < argc){
+                config.set(arg.substr(2), argv[++i]);
+            }
+            else{
+                throw std::invalid_argument("unexpected argument " + arg);
+            }
+        }
+        if (config.shards > 1 && !config.seeded){
+            throw std::invalid_argument("sharded sweeps need --seed, the same for every shard");
+        }
+        if (merge){
+            merge_shards(config);
+        }
+        else{
+            run_sweep(config);
+        }
+    }
+    catch (const std::exception& error){
+        std::cerr << "sweep: " << error.what() << "\n";
+        return 1;
+    }
+    instrument_report(std::cerr);
+    return 0;
+}